@@ -1,102 +1,232 @@
-// bitmap width does NOT include null terminator
+// uint8_t
+#include <stdint.h>
+
+// bitmap width in bits
 #define BITMAP_WIDTH 3
 #define BITMAP_HEIGHT 5
 #define BITMAP_SPACE 1
 
-const char* BITMAP_ONE[] = {
-	" # ",
-	"## ",
-	" # ",
-	" # ",
-	"###"};
-
-const char* BITMAP_TWO[] = {
-	"###",
-	"  #",
-	"###",
-	"#  ",
-	"###"};
-
-const char* BITMAP_THREE[] = {
-	"###",
-	"  #",
-	"###",
-	"  #",
-	"###"};
-
-const char* BITMAP_FOUR[] = {
-	"# #",
-	"# #",
-	"###",
-	"  #",
-	"  #"};
-
-const char* BITMAP_FIVE[] = {
-	"###",
-	"#  ",
-	"###",
-	"  #",
-	"###"};
-
-const char* BITMAP_SIX[] = {
-	"###",
-	"#  ",
-	"###",
-	"# #",
-	"###"};
-
-const char* BITMAP_SEVEN[] = {
-	"###",
-	"# #",
-	"  #",
-	"  #",
-	"  #"};
-
-const char* BITMAP_EIGHT[] = {
-	"###",
-	"# #",
-	"###",
-	"# #",
-	"###"};
-
-const char* BITMAP_NINE[] = {
-	"###",
-	"# #",
-	"###",
-	"  #",
-	"###"};
-
-const char* BITMAP_ZERO[] = {
-	"###",
-	"# #",
-	"# #",
-	"# #",
-	"###"};
-
-const char* BITMAP_COLON[] = {
-	"   ",
-	" # ",
-	"   ",
-	" # ",
-	"   "};
-
-const char* BITMAP_PERIOD[] = {
-	"   ",
-	"   ",
-	"   ",
-	"   ",
-	" # "};
-
-const char* BITMAP_HYPHEN[] = {
-	"   ",
-	"   ",
-	"###",
-	"   ",
-	"   "};
-
-const char* BITMAP_X[] = {
-	"# #",
-	"# #",
-	" # ",
-	"# #",
-	"# #"};
+enum Glyph
+{
+	// unknown characters are drawn with GLYPH_X, so it must be zero
+	GLYPH_X = 0,
+	GLYPH_ZERO,
+	GLYPH_ONE,
+	GLYPH_TWO,
+	GLYPH_THREE,
+	GLYPH_FOUR,
+	GLYPH_FIVE,
+	GLYPH_SIX,
+	GLYPH_SEVEN,
+	GLYPH_EIGHT,
+	GLYPH_NINE,
+	GLYPH_COLON,
+	GLYPH_PERIOD,
+	GLYPH_HYPHEN,
+	GLYPH_SPACE,
+	// letters of the lap statistic labels. S is drawn as a five and X as GLYPH_X
+	GLYPH_A,
+	GLYPH_D,
+	GLYPH_G,
+	GLYPH_I,
+	GLYPH_M,
+	GLYPH_N,
+	GLYPH_P,
+	GLYPH_V,
+	GLYPH_COUNT
+};
+
+/**
+ * Packed glyph bitmaps. Each row is a BITMAP_WIDTH bit mask 
+ * where the most significant bit is the leftmost column.
+ */
+const uint8_t GLYPH_BITMAPS[GLYPH_COUNT][BITMAP_HEIGHT] = {
+	[GLYPH_X] = {
+		0b101,
+		0b101,
+		0b010,
+		0b101,
+		0b101},
+
+	[GLYPH_ZERO] = {
+		0b111,
+		0b101,
+		0b101,
+		0b101,
+		0b111},
+
+	[GLYPH_ONE] = {
+		0b010,
+		0b110,
+		0b010,
+		0b010,
+		0b111},
+
+	[GLYPH_TWO] = {
+		0b111,
+		0b001,
+		0b111,
+		0b100,
+		0b111},
+
+	[GLYPH_THREE] = {
+		0b111,
+		0b001,
+		0b111,
+		0b001,
+		0b111},
+
+	[GLYPH_FOUR] = {
+		0b101,
+		0b101,
+		0b111,
+		0b001,
+		0b001},
+
+	[GLYPH_FIVE] = {
+		0b111,
+		0b100,
+		0b111,
+		0b001,
+		0b111},
+
+	[GLYPH_SIX] = {
+		0b111,
+		0b100,
+		0b111,
+		0b101,
+		0b111},
+
+	[GLYPH_SEVEN] = {
+		0b111,
+		0b101,
+		0b001,
+		0b001,
+		0b001},
+
+	[GLYPH_EIGHT] = {
+		0b111,
+		0b101,
+		0b111,
+		0b101,
+		0b111},
+
+	[GLYPH_NINE] = {
+		0b111,
+		0b101,
+		0b111,
+		0b001,
+		0b111},
+
+	[GLYPH_COLON] = {
+		0b000,
+		0b010,
+		0b000,
+		0b010,
+		0b000},
+
+	[GLYPH_PERIOD] = {
+		0b000,
+		0b000,
+		0b000,
+		0b000,
+		0b010},
+
+	[GLYPH_HYPHEN] = {
+		0b000,
+		0b000,
+		0b111,
+		0b000,
+		0b000},
+
+	[GLYPH_SPACE] = {
+		0b000,
+		0b000,
+		0b000,
+		0b000,
+		0b000},
+
+	[GLYPH_A] = {
+		0b010,
+		0b101,
+		0b111,
+		0b101,
+		0b101},
+
+	[GLYPH_D] = {
+		0b110,
+		0b101,
+		0b101,
+		0b101,
+		0b110},
+
+	[GLYPH_G] = {
+		0b111,
+		0b100,
+		0b101,
+		0b101,
+		0b111},
+
+	[GLYPH_I] = {
+		0b111,
+		0b010,
+		0b010,
+		0b010,
+		0b111},
+
+	[GLYPH_M] = {
+		0b101,
+		0b111,
+		0b111,
+		0b101,
+		0b101},
+
+	[GLYPH_N] = {
+		0b110,
+		0b101,
+		0b101,
+		0b101,
+		0b101},
+
+	[GLYPH_P] = {
+		0b111,
+		0b101,
+		0b111,
+		0b100,
+		0b100},
+
+	[GLYPH_V] = {
+		0b101,
+		0b101,
+		0b101,
+		0b101,
+		0b010}};
+
+/**
+ * Glyph of every character. Characters without an entry map to GLYPH_X.
+ */
+const uint8_t CHAR_GLYPHS[256] = {
+	['0'] = GLYPH_ZERO,
+	['1'] = GLYPH_ONE,
+	['2'] = GLYPH_TWO,
+	['3'] = GLYPH_THREE,
+	['4'] = GLYPH_FOUR,
+	['5'] = GLYPH_FIVE,
+	['6'] = GLYPH_SIX,
+	['7'] = GLYPH_SEVEN,
+	['8'] = GLYPH_EIGHT,
+	['9'] = GLYPH_NINE,
+	[':'] = GLYPH_COLON,
+	['.'] = GLYPH_PERIOD,
+	['-'] = GLYPH_HYPHEN,
+	[' '] = GLYPH_SPACE,
+	['A'] = GLYPH_A,
+	['D'] = GLYPH_D,
+	['G'] = GLYPH_G,
+	['I'] = GLYPH_I,
+	['M'] = GLYPH_M,
+	['N'] = GLYPH_N,
+	['P'] = GLYPH_P,
+	['S'] = GLYPH_FIVE,
+	['V'] = GLYPH_V,
+	['X'] = GLYPH_X};
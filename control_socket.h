@@ -0,0 +1,66 @@
+// uint8_t, int64_t
+#include <stdint.h>
+
+// most commands accepted in one datagram. larger datagrams are truncated
+#define CONTROL_MAX_COMMANDS 64
+// the command carries a CLOCK_MONOTONIC timestamp in timeNs
+#define CONTROL_FLAG_TIMESTAMP 1
+
+/**
+ * Commands accepted by the stopwatch control socket.
+ */
+enum ControlCode
+{
+	CONTROL_START = 1,
+	CONTROL_STOP,
+	CONTROL_SPLIT,
+	// only takes effect while stopped, like the left button
+	CONTROL_RESET
+};
+
+/**
+ * Result of a command.
+ */
+enum ControlStatus
+{
+	CONTROL_APPLIED = 0,
+	// the command had no effect in the current timer state
+	CONTROL_IGNORED,
+	CONTROL_UNKNOWN,
+	// the timestamp lies in the future, before the start of the current run or the last split,
+	// or before the last stop or reset
+	CONTROL_INVALID_TIME
+};
+
+/**
+ * One command. A datagram sent to the control socket holds an array of these,
+ * which are applied together with the button presses in the order they take effect.
+ */
+struct ControlCommand
+{
+	// enum ControlCode
+	uint8_t code;
+	// CONTROL_FLAG_*
+	uint8_t flags;
+	uint8_t reserved[6];
+	// CLOCK_MONOTONIC moment the command takes effect. without CONTROL_FLAG_TIMESTAMP
+	// the command takes effect when the stopwatch receives it
+	int64_t timeNs;
+};
+
+/**
+ * Acknowledgement of one command. If the sender's socket has an address, it receives
+ * one datagram holding an acknowledgement for every command of its datagram.
+ */
+struct ControlAck
+{
+	// enum ControlCode of the command
+	uint8_t code;
+	// enum ControlStatus
+	uint8_t status;
+	uint8_t reserved[2];
+	// number of splits recorded since the last reset
+	uint32_t splitCount;
+	// the split value for a split, otherwise the timer value when the command took effect
+	int64_t timerNs;
+};
@@ -1,6 +1,12 @@
+// sched_setaffinity, CPU_SET
+#define _GNU_SOURCE
+// bool
+#include <stdbool.h>
 // memset, memcpy
 #include <string.h>
-// usleep
+// calloc, free
+#include <stdlib.h>
+// read, close
 #include <unistd.h>
 // printf
 #include <stdio.h>
@@ -20,14 +26,121 @@
 #include <time.h>
 // timeval
 #include <sys/time.h>
+// EVIOCSCLOCKID
+#include <linux/input.h>
+// epoll
+#include <sys/epoll.h>
+// timerfd
+#include <sys/timerfd.h>
+// fstat
+#include <sys/stat.h>
+// getopt_long
+#include <getopt.h>
+// sched_setscheduler
+#include <sched.h>
+// sigaction
+#include <signal.h>
+// render thread
+#include <pthread.h>
+// eventfd
+#include <sys/eventfd.h>
+// control socket
+#include <sys/socket.h>
+#include <sys/un.h>
+// opendir
+#include <dirent.h>
+// errno
+#include <errno.h>
+// PATH_MAX
+#include <limits.h>
 
+#ifdef STOPWATCH_NO_EV3
+// without the ev3dev-c library only the headless backends are available
+#define ev3_init() 0
+#define ev3_uninit()
+#else
 #include "ev3.h"
+#include "ev3_sensor.h"
+#endif
 #include "bitmaps.h"
+#include "timer_shm.h"
+#include "control_socket.h"
+#include "telemetry.h"
 
-#define BUF_SIZE 16
-#define MAX_SPLITS 1
+// default frame buffer and input event devices of the brick
+#define DEFAULT_FB_PATH "/dev/fb0"
+#define DEFAULT_INPUT_PATH "/dev/input/by-path/platform-gpio_keys-event"
+
+#define BUF_SIZE 24
+// splits kept in the history. older splits are overwritten
+#define MAX_SPLITS 4096
 // number of nanoseconds between drawing on the screen
 #define DRAW_NS 73000000
+// most file descriptor events handled per main loop wakeup
+#define MAX_LOOP_EVENTS 8
+// most input events taken from the kernel by a single read
+#define MAX_READ_EVENTS 64
+// button presses that can wait to be processed. one full read of every source fits
+#define INPUT_QUEUE_SIZE (MAX_INPUT_DEVICES * MAX_READ_EVENTS)
+// control datagrams taken per main loop wakeup. the rest wait in the socket
+#define MAX_CONTROL_DATAGRAMS 4
+// input event devices that can be watched at once, touch sensor pipe included
+#define MAX_INPUT_DEVICES 8
+#define MAX_TOUCH_SENSORS 4
+// touch sensors report as these key codes, one per sensor
+#define TOUCH_SENSOR_KEY BTN_TRIGGER_HAPPY1
+// touch sensor sampling period
+#define SENSOR_POLL_NS 2000000
+// directory scanned for event devices
+#define INPUT_DIR "/dev/input"
+// epoll ids of the loop descriptors. input devices use their index
+#define TIMER_EVENT_ID MAX_INPUT_DEVICES
+#define CONTROL_EVENT_ID (MAX_INPUT_DEVICES + 1)
+#define TELEMETRY_EVENT_ID (MAX_INPUT_DEVICES + 2)
+// telemetry subscribers connected at once. later connections are turned away
+#define MAX_TELEMETRY_SUBSCRIBERS 4
+// records a journal file holds. 4 MB with the header
+#define JOURNAL_CAPACITY 131072
+// the sync thread compacts the journal once fewer records than this are free.
+// room for every stored split, and for the appends that happen while it compacts
+#define JOURNAL_HEADROOM (MAX_SPLITS + 1024)
+#define JOURNAL_MAGIC 0x4c4e524a
+// layout version. bumped whenever the journal structs change
+#define JOURNAL_VERSION 1
+#define JOURNAL_SIZE (sizeof(struct JournalHeader) + JOURNAL_CAPACITY * sizeof(struct JournalRecord))
+// lap histogram sub-buckets per power of 2, as a number of bits. quantiles are within 1/32 of the lap
+#define LAP_SUB_BUCKET_BITS 4
+#define LAP_SUB_BUCKETS (1 << LAP_SUB_BUCKET_BITS)
+// enough buckets for every positive int64_t
+#define LAP_BUCKETS ((64 - LAP_SUB_BUCKET_BITS) * LAP_SUB_BUCKETS)
+#define TRACE_MAGIC 0x31435254
+// layout version. bumped whenever the trace structs change
+#define TRACE_VERSION 1
+// trace records in flight between the timing and the trace writer thread. must be a power of 2
+#define TRACE_BUFFER_SIZE 4096
+// the event was read from a device that stamps events with CLOCK_MONOTONIC
+#define TRACE_MONOTONIC 1
+// render requests in flight between the timing and the render thread. must be a power of 2
+#define RENDER_QUEUE_SIZE 64
+// log2 latency histogram buckets. the last bucket collects everything from 2^30 ns
+#define HISTOGRAM_BUCKETS 32
+// SCHED_FIFO priority of the real time mode. above kernel threads that default to 50
+#define REAL_TIME_PRIORITY 60
+// stack of every helper thread. the real time mode locks every stack into memory,
+// and the default of 8 MB would pin most of the brick's 64 MB
+#define THREAD_STACK_SIZE (64 * 1024)
+
+// a word of a pixel bitplane. each bit holds a single pixel
+typedef unsigned long PixelWord;
+#define PIXEL_WORD_BITS (sizeof(PixelWord) * 8)
+// dirty rectangles tracked before they are collapsed into one bounding rectangle
+#define MAX_DIRTY_RECTS 32
+// largest text scale. a scaled glyph row must fit inside 32 bits
+#define MAX_GLYPH_SCALE 10
+// character cells that text slots can register into a blit plan
+#define MAX_PLANNED_CELLS 48
+// a changed character mask has one bit for each character of a string buffer
+typedef uint32_t CharMask;
 
 /////////////////////////////////////////////////////////////////////////
 /// ENUMS
@@ -43,17 +156,89 @@ enum Button
 	DOWN 		= 108
 };
 
+/**
+ * What a key, touch sensor or control command does to the stopwatch.
+ */
+enum Action
+{
+	ACTION_NONE = 0,
+	ACTION_QUIT,
+	ACTION_START_STOP,
+	ACTION_START,
+	ACTION_STOP,
+	ACTION_SPLIT,
+	// only takes effect while stopped
+	ACTION_RESET,
+	ACTION_PREV_SPLIT,
+	ACTION_NEXT_SPLIT,
+	ACTION_COUNT
+};
+
 enum TimerState
 {
 	PAUSED,
-	STARTED,
 	RUNNING
 };
 
+/**
+ * How composed frames reach the screen.
+ */
+enum DisplayMode
+{
+	// frames are written straight into the visible frame buffer
+	DIRECT_DISPLAY,
+	// frames are written into the hidden page of a double height frame buffer, then panned to
+	PAGE_FLIP_DISPLAY,
+	// frames are written into an off-screen copy, then their dirty bytes are copied over
+	SHADOW_DISPLAY
+};
+
+/**
+ * Lap statistics that can be shown on the split line, in browsing order after the newest split.
+ */
+enum LapStat
+{
+	// the split line shows a split
+	LAP_STAT_NONE = 0,
+	LAP_STAT_MIN,
+	LAP_STAT_MAX,
+	LAP_STAT_MEAN,
+	LAP_STAT_STDDEV,
+	LAP_STAT_P50,
+	LAP_STAT_P90,
+	LAP_STAT_P99,
+	LAP_STAT_COUNT
+};
+
+/**
+ * Latencies measured by the main loop.
+ */
+enum LatencyMetric
+{
+	// kernel event timestamp to the end of the flush that shows the press
+	BUTTON_TO_PIXEL,
+	// drawing a redraw frame into the pixel matrix
+	FRAME_RASTERIZE,
+	// writing a redraw frame to the frame buffer
+	FRAME_FLUSH,
+	// distance between the actual and the scheduled interval of two redraw wakeups
+	REDRAW_INTERVAL_ERROR,
+	LATENCY_METRIC_COUNT
+};
+
 /////////////////////////////////////////////////////////////////////////
 /// STRUCTS
 /////////////////////////////////////////////////////////////////////////
 
+/**
+ * Writes a run of same colored pixels inside one row of the frame buffer.
+ * Param rowDest: location of the first byte of the row.
+ * Param col: column of the first pixel of the run.
+ * Param count: number of pixels in the run.
+ * Param isFG: if true, foreground pixels.
+ */
+typedef void (*SpanBlitter)(char* rowDest, unsigned col, unsigned count, bool isFG);
+
 struct FrameBufferInfo
 {
 	// screen dimensions
@@ -65,17 +250,81 @@ struct FrameBufferInfo
 	uint32_t size;
 	// bits per pixel
 	uint32_t bitsPP;
+	// row span writer specialized for bitsPP
+	SpanBlitter blitSpan;
+};
+
+/**
+ * A rectangle of pixels. The bottom and right edges are exclusive.
+ */
+struct DirtyRect
+{
+	int top;
+	int left;
+	int bottom;
+	int right;
+};
+
+/**
+ * Counters describing the work done by the most recent frame buffer write.
+ */
+struct FlushStats
+{
+	// number of dirty rectangles visited
+	int rects;
+	// number of pixels inside the visited rectangles
+	unsigned pixelsVisited;
+	// number of pixels written into the frame buffer
+	unsigned pixelsWritten;
+	// number of same colored runs the pixels were written in
+	unsigned spansWritten;
+};
+
+/**
+ * Sums of the counters of every frame buffer write that had dirty rectangles.
+ */
+struct FlushTotals
+{
+	uint64_t flushes;
+	uint64_t rects;
+	uint64_t pixelsVisited;
+	uint64_t pixelsWritten;
+	uint64_t spansWritten;
 };
 
 /**
- * The pixel matrix is comprised of black and white mono pixel elements.
+ * The pixel matrix is comprised of two packed bitplanes of black and white mono pixels.
+ * Every row starts on a word boundary. Bit i of word w in a row holds 
+ * the pixel in column (w * PIXEL_WORD_BITS + i).
  */
-struct MonoPixelElement
+struct PixelMatrix
 {
-	// is a foreground pixel
-	bool isFG;
-	// when this is true, the pixel has been updated without having been drawn
-	bool drawFlag;
+	// number of words in a single row of a bitplane
+	uint32_t wordsPerRow;
+	// a set bit means the pixel is a foreground pixel
+	PixelWord* fgPlane;
+	// a set bit means the pixel has been updated without having been drawn
+	PixelWord* dirtyPlane;
+	// non overlapping rectangles that contain every set bit of the dirty plane
+	struct DirtyRect dirtyRects[MAX_DIRTY_RECTS];
+	int numDirtyRects;
+	// counters of the last frame buffer write
+	struct FlushStats lastFlush;
+	// counters of every frame buffer write since the allocation
+	struct FlushTotals totalFlush;
+};
+
+/**
+ * File descriptors that wake up the main loop.
+ */
+struct EventLoop
+{
+	// epoll instance watching every other descriptor
+	int epollFd;
+	// expires at every redraw deadline while the timer is running
+	int timerFd;
+	// control socket datagrams. -1 if there is no control socket
+	int controlFd;
 };
 
 struct InputEvent
@@ -91,37 +340,492 @@ struct InputEvent
 };
 
 /**
- * Frame buffer info and pixel matrix are frequently passed together as arguments.
+ * An opened input event device.
  */
-struct FrameBufferPixelMatrix
+struct InputDevice
 {
-	struct FrameBufferInfo fbInfo;
-	struct MonoPixelElement* pixelMatrix;
+	int fd;
+	// true if the kernel stamps events with CLOCK_MONOTONIC
+	bool hasMonotonicTime;
+	// regular files cannot be watched by epoll and are always ready to read
+	bool isRegularFile;
+	// a pipe or file that ran out of events
+	bool isEnded;
+	// the events come from the replayed trace instead of fd
+	bool isTrace;
+	// start of an event that a pipe delivered only partly. the next read completes it
+	char partial[sizeof(struct InputEvent)];
+	int partialBytes;
+};
+
+/**
+ * Start of an input trace file.
+ */
+struct TraceHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t recordSize;
+	uint32_t reserved;
+};
+
+/**
+ * An input event as it was read. The layout does not depend on the size of struct timeval,
+ * so a trace recorded on the brick can be replayed on any machine.
+ */
+struct TraceRecord
+{
+	// CLOCK_MONOTONIC moment the event was read
+	int64_t readNs;
+	// the fields of struct InputEvent
+	int64_t eventSec;
+	int32_t eventUsec;
+	uint16_t type;
+	uint16_t code;
+	uint32_t value;
+	// index of the input device that delivered the event
+	uint8_t device;
+	// TRACE_* flags
+	uint8_t flags;
+	uint8_t reserved[2];
+};
+
+/**
+ * Input events being recorded to a trace file. The timing thread fills a lock-free ring
+ * with a single producer and a single consumer, and a writer thread writes it out once per batch of reads.
+ * Both indices run freely and are masked on access.
+ */
+struct TraceRecorder
+{
+	// trace file. -1 if not recording
+	int fd;
+	// TRACE_BUFFER_SIZE records
+	struct TraceRecord* records;
+	// next record to write out. written by the writer thread only
+	uint32_t head;
+	// next free slot. written by the timing thread only
+	uint32_t tail;
+	// the writer thread sleeps on this counter until a batch is flushed
+	int eventFd;
+	pthread_t thread;
+	// the writer thread writes out the rest of the ring and exits
+	bool isQuit;
+	// records that did not fit into the full ring. only touched by the timing thread
+	uint32_t numDropped;
+};
+
+/**
+ * A trace file played back as an input device on a virtual clock.
+ */
+struct Replay
+{
+	// the mapped trace file. NULL if not replaying
+	void* mem;
+	size_t size;
+	const struct TraceRecord* records;
+	uint64_t numRecords;
+	// index of the next record to play
+	uint64_t next;
+	// play back as fast as possible instead of in real time
+	bool isFast;
+	// the moment the playback started, and the trace time it started at
+	int64_t startNs;
+	int64_t traceStartNs;
+	// next redraw deadline on the virtual clock. 0 while the timer is paused
+	int64_t redrawNs;
+	uint64_t redraws;
+};
+
+struct ButtonPress
+{
+	enum Action action;
+	// CLOCK_MONOTONIC time of the press
+	struct timespec time;
+	// control command the press came from, as datagram * CONTROL_MAX_COMMANDS + command.
+	// -1 for a button press
+	int command;
+};
+
+/**
+ * Time ordered ring of button presses waiting to be processed.
+ */
+struct InputQueue
+{
+	struct ButtonPress presses[INPUT_QUEUE_SIZE];
+	// index of the oldest press
+	int head;
+	int count;
+};
+
+/**
+ * A datagram of control commands whose presses wait in the input queue, 
+ * and the acknowledgements its sender receives once they have been applied.
+ */
+struct ControlDatagram
+{
+	struct sockaddr_un sender;
+	socklen_t senderLen;
+	struct timespec receivedTs;
+	int numCommands;
+	struct ControlAck acks[CONTROL_MAX_COMMANDS];
+};
+
+/**
+ * Every source of input events and the action each key code maps to.
+ * Touch sensors are polled by their own thread, which feeds a pipe that is read like a device.
+ */
+struct InputSources
+{
+	struct InputDevice devices[MAX_INPUT_DEVICES];
+	int numDevices;
+	// bit i is set if device i is a regular file that has not ended
+	uint32_t regularFileMask;
+	int numEnded;
+	// enum Action of every key code
+	uint8_t keyActions[KEY_CNT];
+	// touch sensor serial numbers of the ev3 library and the key code each one reports
+	uint8_t sensors[MAX_TOUCH_SENSORS];
+	int numSensors;
+	// write end of the touch sensor pipe. -1 without touch sensors
+	int sensorPipeFd;
+	pthread_t sensorThread;
+	// the touch sensor thread exits at its next sample
+	bool isSensorQuit;
+	// presses of every source, control commands included, waiting to be applied in time order
+	struct InputQueue queue;
+	// control datagrams waiting for their acknowledgements
+	struct ControlDatagram datagrams[MAX_CONTROL_DATAGRAMS];
+	int numDatagrams;
+	struct TraceRecorder recorder;
+	struct Replay replay;
+};
+
+/**
+ * Command line options selecting the display and input backends.
+ */
+struct Options
+{
+	// draw into a memory frame buffer instead of the brick's display
+	bool isHeadless;
+	// geometry of the headless frame buffer
+	uint32_t headlessWidth;
+	uint32_t headlessHeight;
+	uint32_t headlessBitsPP;
+	// frame buffer device. in headless mode the optional backing file
+	const char* fbPath;
+	// input event files. "-" means standard input
+	const char* inputPaths[MAX_INPUT_DEVICES];
+	int numInputPaths;
+	// also open every event device under /dev/input that has keys
+	bool isInputScan;
+	// poll the ev3 touch sensors
+	bool isTouchSensors;
+	// enum Action of every key code
+	uint8_t keyActions[KEY_CNT];
+	// run the microbenchmarks instead of the stopwatch
+	bool isBench;
+	// run under SCHED_FIFO with locked memory and report wakeup jitter
+	bool isRealTime;
+	// print the latency histograms on exit
+	bool isLatencyReport;
+	// compose frames off-screen so that they appear at once
+	bool isDoubleBuffered;
+	// UNIX datagram socket accepting control commands. NULL for none
+	const char* controlPath;
+	// UNIX seqpacket socket streaming timer events. NULL for none
+	const char* telemetryPath;
+	// session journal file. NULL for none
+	const char* journalPath;
+	// trace file every input event is recorded to. NULL for none
+	const char* recordPath;
+	// trace file played back instead of the brick buttons. NULL for none
+	const char* replayPath;
+	// play the trace back as fast as possible
+	bool isReplayFast;
+};
+
+/**
+ * The memory mapped frame buffer and the buffer frames are composed in.
+ */
+struct FrameBufferDisplay
+{
+	enum DisplayMode mode;
+	// the memory mapped frame buffer. holds both pages when page flipping
+	char* fbDest;
+	// frames are written here. the hidden page, the shadow buffer, or fbDest in direct mode
+	char* drawDest;
+	// bytes of one screen page
+	uint32_t pageSize;
+	// page currently scanned out when page flipping
+	uint32_t frontPage;
+	// frame buffer device kept open for panning. -1 if not page flipping
+	int fd;
+	// variable screen info passed to FBIOPAN_DISPLAY
+	struct fb_var_screeninfo fbVar;
+	// the screen info before the virtual resolution was doubled, restored on exit
+	struct fb_var_screeninfo origFbVar;
+	bool isResized;
+};
+
+/**
+ * Log scale histogram of nanosecond latencies. Bucket i counts samples below 2^i ns.
+ * Each histogram has a single writer thread. Other threads may print it at any time, 
+ * and 64-bit fields can tear on the brick's 32-bit ARM. So it is guarded by a seqlock
+ * like the shared timer state: sequence is odd while a sample is being added.
+ */
+struct Histogram
+{
+	uint32_t sequence;
+	uint64_t counts[HISTOGRAM_BUCKETS];
+	int64_t maxNs;
+};
+
+/**
+ * Latency histograms of the main loop.
+ */
+struct LatencyStats
+{
+	struct Histogram histograms[LATENCY_METRIC_COUNT];
+	// the previous redraw wakeup in nanoseconds. 0 after the redraw timer was armed
+	int64_t lastRedrawNs;
+};
+
+/**
+ * A screen update handed from the timing thread to the render thread.
+ * Only the parts that are flagged are drawn.
+ */
+struct RenderRequest
+{
+	bool hasTitle;
+	int64_t titleNs;
+	bool hasSplit;
+	// 1-based number of the shown split. 0 if there are no splits
+	uint32_t splitNumber;
+	// the split, or the lap statistic if one is shown instead
+	int64_t splitNs;
+	enum LapStat lapStat;
+	// event timestamp of the button press behind the request. 0 for redraws
+	int64_t eventNs;
+	// the render thread exits after drawing this request
+	bool isQuit;
+};
+
+/**
+ * Lock-free ring of render requests with a single producer and a single consumer.
+ * Both indices run freely and are masked on access.
+ */
+struct RenderQueue
+{
+	struct RenderRequest requests[RENDER_QUEUE_SIZE];
+	// next request to pop. written by the render thread only
+	uint32_t head;
+	// next free slot. written by the timing thread only
+	uint32_t tail;
+};
+
+/**
+ * The render thread and everything it owns once it runs.
+ */
+struct Renderer
+{
+	struct RenderQueue queue;
+	// the render thread sleeps on this counter while the queue is empty
+	int eventFd;
+	pthread_t thread;
+	// a request that did not fit into the full queue. only touched by the timing thread
+	struct RenderRequest pending;
+	bool isPending;
+	struct FrameBufferDisplay* display;
+	const struct FrameBufferPixelMatrix* fbpm;
+	struct TextFormat* titleFormat;
+	struct TextFormat* splitFormat;
+	// the render thread records the frame costs and button to pixel times here
+	struct LatencyStats* latency;
+};
+
+/**
+ * Publisher of the telemetry stream. Records are collected while input is processed
+ * and sent to every subscriber in one message per batch.
+ */
+struct Telemetry
+{
+	// listening socket. -1 without telemetry
+	int listenFd;
+	// connected non blocking subscriber sockets
+	int subscriberFds[MAX_TELEMETRY_SUBSCRIBERS];
+	int numSubscribers;
+	// records waiting for the next flush
+	struct TelemetryRecord batch[TELEMETRY_BATCH_SIZE];
+	int batchSize;
+	// number of the first record of the batch among every record sent
+	uint64_t nextIndex;
+	// records that subscribers with full sockets did not receive
+	uint64_t shedRecords;
+};
+
+/**
+ * Start of a journal file.
+ */
+struct JournalHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t recordSize;
+	uint32_t capacity;
+	// bumped every time the journal is opened. records must not go back to an older epoch
+	uint32_t epoch;
+	uint32_t reserved[3];
+};
+
+/**
+ * A timer event in the journal. Records are only ever appended.
+ */
+struct JournalRecord
+{
+	// CRC-32 of every byte after this field. zeroed or torn records fail it
+	uint32_t checksum;
+	// epoch of the journal when the record was written. 
+	// records left behind a torn record by an earlier run have an older epoch than the ones before them
+	uint32_t epoch;
+	// number of splits recorded since the last reset. for a split, the number of that split
+	uint32_t splitCount;
+	// enum TelemetryType
+	uint8_t type;
+	uint8_t reserved[3];
+	// CLOCK_REALTIME moment of the event. the monotonic clock does not survive a reboot
+	int64_t realNs;
+	// timer value at the event
+	int64_t elapsedNs;
+};
+
+/**
+ * Memory mapped journal of the session. The timing thread appends to the mapping,
+ * and a sync thread writes the appended records out to the file.
+ */
+struct Journal
+{
+	// file path. NULL without a journal
+	const char* path;
+	// the whole mapped file. the records follow the header
+	struct JournalHeader* header;
+	struct JournalRecord* records;
+	// appended records. written by the timing thread only
+	uint32_t numRecords;
+	// numRecords at the last wake up of the sync thread
+	uint32_t requestedRecords;
+	// records known to be on the file. guarded by mapLock
+	uint32_t syncedRecords;
+	// records that did not fit into a full journal
+	uint64_t droppedRecords;
+	// the sync thread sleeps on this counter until records are appended
+	int eventFd;
+	pthread_t syncThread;
+	// held while the sync thread writes out the mapping, and while compaction replaces it
+	pthread_mutex_t mapLock;
+	bool isQuit;
+	// compacted journal the sync thread prepared in the file PATH.tmp. NULL until it is ready
+	struct JournalHeader* spareHeader;
+	// records of the compacted journal, and the records of this journal they replace
+	uint32_t spareRecords;
+	uint32_t compactedRecords;
+	// mapping replaced by the compacted journal. the sync thread renames over its file 
+	// and unmaps it. guarded by mapLock
+	struct JournalHeader* retiredHeader;
+};
+
+/**
+ * Lateness of redraw wakeups behind their deadlines.
+ */
+struct WakeupStats
+{
+	// the next expected redraw deadline in nanoseconds. 0 while the redraw timer is disarmed
+	int64_t deadlineNs;
+	uint64_t wakeups;
+	// deadlines that passed without a wakeup of their own
+	uint64_t missedDeadlines;
+	int64_t totalLateNs;
+	int64_t minLateNs;
+	int64_t maxLateNs;
+};
+
+/**
+ * Stopwatch time keeping. 
+ * Nothing is updated while running. The timer value is derived from startTs when it is needed.
+ */
+struct Timer
+{
+	enum TimerState state;
+	// time counted before the current run
+	int64_t accumulatedNs;
+	// the moment the current run started. only meaningful while running
+	struct timespec startTs;
+	// the moment of the last stop or reset. a later run must not start before it
+	struct timespec pausedTs;
+};
+
+/**
+ * Running statistics of every lap since the last reset. Updates take constant time,
+ * and the memory does not grow with the number of laps.
+ */
+struct LapStats
+{
+	uint64_t count;
+	int64_t minNs;
+	int64_t maxNs;
+	// Welford's running mean and sum of squared distances from the mean
+	double meanNs;
+	double sumSquaresNs;
+	// log scale histogram of the laps for the quantiles. see getLapBucket
+	uint32_t buckets[LAP_BUCKETS];
 };
 
 /**
- * Frame buffer bit information of a given pixel inside the pixel matrix.
+ * Ring of the most recent splits. Every split is numbered in recording order.
  */
-struct FramePixelBitInfo
+struct SplitHistory
 {
-	// current pixel index inside the pixel matrix
-	int pixelIndex;
-	// the first bit of a given pixel
-	int bitStartIndex;
-	// the last bit of a given pixel
-	int bitEndIndex;
-	// index of the byte containing the first bit of a given pixel
-	int byteStartIndex;
-	// index of the first pixel bit inside a byte. this is in [0, 7]
-	int startIndexOffset;
-	// index of the byte containing the last bit in a given pixel
-	int byteEndIndex;
-	// index of the last pixel bit inside a byte. this is in [0, 7]
-	int endIndexOffset;
-	// how many char-aligned bytes the pixel spans. 0 means it spans a single byte
-	int byteRange;
-	// the index of the first bit of a given row
-	int rowStartBit;
+	// timer value of each split
+	int64_t splitNs[MAX_SPLITS];
+	// time since the previous split
+	int64_t lapNs[MAX_SPLITS];
+	// number of splits recorded since the last reset. may exceed MAX_SPLITS
+	uint32_t total;
+	// number of the split shown on the split line
+	uint32_t viewIndex;
+	// lap statistic shown on the split line instead of the split
+	enum LapStat shownStat;
+	struct LapStats lapStats;
+};
+
+/**
+ * A timer value broken down into the fields of its HH:MM:SS.mmm string.
+ * The fields can be advanced with carries instead of dividing the full nanosecond count.
+ */
+struct TimeFields
+{
+	// the value the fields represent
+	int64_t ns;
+	// nanoseconds below the current millisecond
+	int32_t subMsNs;
+	int ms;
+	int seconds;
+	int minutes;
+	int hours;
+	// the formatted string. minutes start at minutesPos
+	char str[BUF_SIZE];
+	int len;
+	int minutesPos;
+};
+
+/**
+ * Frame buffer info and pixel matrix are frequently passed together as arguments.
+ */
+struct FrameBufferPixelMatrix
+{
+	struct FrameBufferInfo fbInfo;
+	struct PixelMatrix* pixelMatrix;
+	// precomputed offsets of the frame buffer layout
+	struct BlitPlan* blitPlan;
 };
 
 struct TextFormat
@@ -131,6 +835,69 @@ struct TextFormat
 	int posX;
 	// scale determines bit width. ie scale of 3 means each bit is 3x3 pixels.
 	int scale;
+	// the string most recently drawn with this format
+	char lastStr[BUF_SIZE];
+	int lastLen;
+	// compiled cells of a text slot registered into a blit plan. NULL if not registered
+	const struct CellPlan* cells;
+	int numCells;
+};
+
+/**
+ * Glyph rows widened to a given scale.
+ */
+struct ScaledGlyphs
+{
+	// true once the rows have been computed
+	bool isBuilt;
+	// each glyph row is BITMAP_WIDTH * scale bits wide. 
+	// bit i is the pixel i columns to the right of the left edge of the glyph
+	uint32_t rows[GLYPH_COUNT][BITMAP_HEIGHT];
+};
+
+/**
+ * Precomputed destination of one pixel row of a character cell inside the pixel matrix.
+ */
+struct PlannedRow
+{
+	// index of the bitplane word holding the leftmost pixel of the row
+	uint32_t wordIndex;
+	// column of the leftmost pixel inside that word
+	uint8_t shift;
+	// glyph bitmap row shown by this pixel row
+	uint8_t bitRow;
+	// onscreen bits of the row inside the first word and inside the word after it
+	PixelWord lowMask;
+	PixelWord highMask;
+};
+
+/**
+ * Precomputed destinations of every onscreen pixel row of a single character cell.
+ */
+struct CellPlan
+{
+	// onscreen part of the cell
+	struct DirtyRect rect;
+	int numRows;
+	struct PlannedRow rows[BITMAP_HEIGHT * MAX_GLYPH_SCALE];
+	// glyph rows widened to the scale of the cell
+	const struct ScaledGlyphs* glyphs;
+};
+
+/**
+ * Offsets of a frame buffer layout that never change during a run.
+ * Text slots register into the plan to have their character cells compiled.
+ * Cells are compiled against the pixel matrix bitplanes rather than frame buffer bytes.
+ * Glyphs must go through the bitplanes for the dirty rectangles, the skip of unchanged pixels 
+ * and the choice of span writer for the display depth. Only the final flush addresses 
+ * frame buffer bytes, through rowOffsets.
+ */
+struct BlitPlan
+{
+	// byte offset of each row inside the frame buffer
+	uint32_t* rowOffsets;
+	int numCells;
+	struct CellPlan cells[MAX_PLANNED_CELLS];
 };
 
 /**
@@ -138,13 +905,18 @@ struct TextFormat
  * Param format: pointer to the struct to initialize.
  * Param x: X position.
  * Param y: Y position.
- * Param s: scale.
+ * Param s: scale. Clamped to [1, MAX_GLYPH_SCALE].
  */
 void initTextFormat(struct TextFormat* format, int y, int x, int s)
 {
 	format->posY = y;
 	format->posX = x;
-	format->scale = s;
+	format->scale = s < 1 ? 1 : s > MAX_GLYPH_SCALE ? MAX_GLYPH_SCALE : s;
+	// nothing has been drawn yet
+	format->lastStr[0] = '\0';
+	format->lastLen = 0;
+	format->cells = NULL;
+	format->numCells = 0;
 }
 
 /**
@@ -154,11 +926,52 @@ void initTextFormat(struct TextFormat* format, int y, int x, int s)
  * Param pixelMatrix: pointer to the pixel matrix.
  */
 void initFrameBufferPixelMatrix(struct FrameBufferPixelMatrix* fbpm, 
-	const struct FrameBufferInfo* fbInfo, struct MonoPixelElement* pixelMatrix)
+	const struct FrameBufferInfo* fbInfo, struct PixelMatrix* pixelMatrix)
 {
 	// copy information from given fbInfo struct
 	fbpm->fbInfo = *fbInfo;
 	fbpm->pixelMatrix = pixelMatrix;
+	// set by buildBlitPlan
+	fbpm->blitPlan = NULL;
+}
+
+/**
+ * Allocate both bitplanes of a pixel matrix. All pixels start as clean background pixels.
+ * Param pixelMatrix: pointer to the pixel matrix to allocate.
+ * Param fbInfo: pointer to frame buffer info that determines the matrix dimensions.
+ * Return true if the allocation was successful.
+ */
+bool allocPixelMatrix(struct PixelMatrix* pixelMatrix, const struct FrameBufferInfo* fbInfo)
+{
+	bool success;
+	size_t planeWords;
+	pixelMatrix->numDirtyRects = 0;
+	memset(&pixelMatrix->lastFlush, 0, sizeof(pixelMatrix->lastFlush));
+	memset(&pixelMatrix->totalFlush, 0, sizeof(pixelMatrix->totalFlush));
+	pixelMatrix->wordsPerRow = (fbInfo->screenWidth + PIXEL_WORD_BITS - 1) / PIXEL_WORD_BITS;
+	planeWords = (size_t)pixelMatrix->wordsPerRow * fbInfo->screenHeight;
+	// both planes share a single allocation
+	pixelMatrix->fgPlane = calloc(planeWords * 2, sizeof(PixelWord));
+	if((success = pixelMatrix->fgPlane != NULL))
+	{
+		pixelMatrix->dirtyPlane = pixelMatrix->fgPlane + planeWords;
+	}
+	else
+	{
+		printf("Error allocating pixel matrix\n");
+	}
+	return success;
+}
+
+/**
+ * Free the bitplanes of a pixel matrix.
+ * Param pixelMatrix: pointer to the pixel matrix to free.
+ */
+void freePixelMatrix(struct PixelMatrix* pixelMatrix)
+{
+	free(pixelMatrix->fgPlane);
+	pixelMatrix->fgPlane = NULL;
+	pixelMatrix->dirtyPlane = NULL;
 }
 
 /////////////////////////////////////////////////////////////////////////
@@ -179,675 +992,5195 @@ void printFbInfo(const struct FrameBufferInfo* fbInfo)
 		printf("Bits per Pixel: %u bits\n", fbInfo->bitsPP);
 }
 
-/////////////////////////////////////////////////////////////////////////
-/// INPUT FUNCTIONS
-/////////////////////////////////////////////////////////////////////////
+/**
+ * Print the summed counters of every frame buffer write that had dirty rectangles.
+ * param pixelMatrix: pointer to the pixel matrix that was written.
+ */
+void printFlushStats(const struct PixelMatrix* pixelMatrix)
+{
+		printf("--- Flush Stats ---\n");
+		printf("Flushes: %llu\n", (unsigned long long)pixelMatrix->totalFlush.flushes);
+		printf("Rects: %llu\n", (unsigned long long)pixelMatrix->totalFlush.rects);
+		printf("Pixels Visited: %llu\n", (unsigned long long)pixelMatrix->totalFlush.pixelsVisited);
+		printf("Pixels Written: %llu\n", (unsigned long long)pixelMatrix->totalFlush.pixelsWritten);
+		printf("Spans Written: %llu\n", (unsigned long long)pixelMatrix->totalFlush.spansWritten);
+}
 
 /**
- * Read from the input event file for an input event.
- * Param fd: input event file descriptor.
- * Return the button code of the input event. -1 if no event was found.
+ * Print the lateness of redraw wakeups.
+ * param stats: pointer to the wakeup statistics.
  */
-int readInputEvent(int fd)
+void printWakeupStats(const struct WakeupStats* stats)
 {
-	struct InputEvent iEvent;
-	int retVal = -1;
-	// repeatedly read from the file until there are no more events
-	// or we have found what we are looking for
-	while(retVal < 0 && read(fd, &iEvent, sizeof(iEvent)) >= 0)
+	printf("--- Wakeup Stats ---\n");
+	printf("Redraw wakeups: %llu\n", (unsigned long long)stats->wakeups);
+	if(stats->wakeups > 0)
 	{
-		// event must be a button press (not a release)
-		if(iEvent.type == 1 && iEvent.value == 1)
-		{
-			// return button code of the event
-			retVal = iEvent.code;
-		}
+		printf("Wakeup lateness us: min %lld, mean %lld, max %lld\n", 
+			(long long)(stats->minLateNs / 1000), 
+			(long long)(stats->totalLateNs / (int64_t)stats->wakeups / 1000), 
+			(long long)(stats->maxLateNs / 1000));
 	}
-	return retVal;
+	printf("Missed deadlines: %llu\n", (unsigned long long)stats->missedDeadlines);
 }
 
 /////////////////////////////////////////////////////////////////////////
-/// TIME FUNCTIONS
+/// THREAD FUNCTIONS
 /////////////////////////////////////////////////////////////////////////
 
 /**
- * Given a positive number of nanoseconds, write
- * a string with format HH:MM:SS.mmm to a given buffer.
- * param ns: the number of nanoseconds.
- * param timeStrBuf: char array buffer to be written to.
- * param bufferSize: the size of the char array buffer in bytes.
- * return true if the time was written to the string buffer.
+ * Start a helper thread with a stack of THREAD_STACK_SIZE.
+ * SIGUSR1 is meant for the timing thread, so it stays blocked in the new thread.
+ * Param thread: receives the new thread.
+ * Param body: the thread body.
+ * Param arg: the argument of the thread body.
+ * Return true if the thread started.
  */
-bool nsToString(int64_t ns, char* timeStrBuf, int bufferSize)
-{	
+bool startThread(pthread_t* thread, void* (*body)(void*), void* arg)
+{
 	bool success;
-	// buffer pointer must be non null
-	// buffer size must be at least 1
-	// milliseconds must be non negative
-	if((success = timeStrBuf && bufferSize >= 1 && ns >= 0))
+	pthread_attr_t attr;
+	sigset_t blocked;
+	sigset_t prevMask;
+	if((success = !pthread_attr_init(&attr)))
 	{
-		// OUTPUT_SIZE includes null terminator
-		const int OUTPUT_SIZE = 13;
-		if((success = bufferSize >= OUTPUT_SIZE))
-		{
-			int64_t ms = ns / 1000000;
-			int msToPrint = ms % 1000;
-			int seconds = ms / 1000;
-			int secondsToPrint = seconds % 60;
-			int minutes = seconds / 60;
-			int minutesToPrint = minutes % 60;
-			int hoursToPrint = minutes / 60;
-
-			if(hoursToPrint > 0)
-			{
-				snprintf(timeStrBuf, OUTPUT_SIZE, "%d:%02d:%02d.%03d", 
-					hoursToPrint, minutesToPrint, secondsToPrint, msToPrint);
-			}
-			else
-			{
-				snprintf(timeStrBuf, OUTPUT_SIZE, "%02d:%02d.%03d", 
-					minutesToPrint, secondsToPrint, msToPrint);
-			}
-		}
-		else
-		{
-			// buffer size insufficient
-			*timeStrBuf = '\0';
-		}
+		// the new thread inherits the blocked mask
+		sigemptyset(&blocked);
+		sigaddset(&blocked, SIGUSR1);
+		pthread_sigmask(SIG_BLOCK, &blocked, &prevMask);
+		success = !pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE)
+			&& !pthread_create(thread, &attr, body, arg);
+		pthread_sigmask(SIG_SETMASK, &prevMask, NULL);
+		pthread_attr_destroy(&attr);
 	}
 	return success;
 }
 
+/////////////////////////////////////////////////////////////////////////
+/// TRACE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+// time of the virtual clock of a replay in nanoseconds. -1 while the timer runs on the real clock
+static int64_t virtualClockNs = -1;
+
 /**
- * Calculate the number of nanoseconds between two timestamps.
- * Param after: the later timestamp.
- * Param before: the earlier timestamp.
- * Return the difference between the two timestamps in nanoseconds.
- * See https://stackoverflow.com/a/64896093
- */
-int64_t diffTimespecNs(const struct timespec after, const struct timespec before)
-{
-    return ((int64_t)after.tv_sec - (int64_t)before.tv_sec) * (int64_t)1000000000
-         + ((int64_t)after.tv_nsec - (int64_t)before.tv_nsec);
-}
-
-/////////////////////////////////////////////////////////////////////////
-/// DRAWING FUNCTIONS
-/////////////////////////////////////////////////////////////////////////
-
-/**
- * Write a pixel to the frame buffer given that the pixel occupies a single byte.
- * Param fbDest: the memory map location of the frame buffer.
- * Param fbpm: frame buffer info + pixel matrix.
- * Param fpbi: frame buffer bit information of a given pixel inside the pixel matrix.
+ * Read the clock the timer runs on. This is CLOCK_MONOTONIC, 
+ * except during a replay, where it is the virtual clock of the trace.
+ * Param ts: pointer to the timestamp that receives the time.
  */
-void writeFbSingleByte(
-	char* fbDest, 
-	const struct FrameBufferPixelMatrix* fbpm, 
-	const struct FramePixelBitInfo* fpbi)
+void getTimerClock(struct timespec* ts)
 {
-	int numShifts = 7 - fpbi->endIndexOffset;
-	char mask = ((1 << fbpm->fbInfo.bitsPP) - 1) << numShifts;
-	if(fbpm->pixelMatrix[fpbi->pixelIndex].isFG)
-	{
-		// AND mask to turn pixel black
-		mask = ~mask;
-		fbDest[fpbi->byteStartIndex] &= mask;
-	}
-	else
+	if(virtualClockNs >= 0)
 	{
-		// OR mask to turn pixel white
-		fbDest[fpbi->byteStartIndex] |= mask;
-	}
-}
-
-/**
- * Write a pixel to the frame buffer given that the pixel occupies two or more bytes.
- * Param fbDest: the memory map location of the frame buffer.
- * Param fbpm: frame buffer info + pixel matrix.
- * Param fpbi: frame buffer bit information of a given pixel inside the pixel matrix.
- */
-void writeFbMultiByte(
-	char* fbDest, 
-	const struct FrameBufferPixelMatrix* fbpm, 
-	const struct FramePixelBitInfo* fpbi)
-{
-	// suffix byte: the byte containing the trailing bits of the pixel
-	int numSuffixShifts = 7 - fpbi->endIndexOffset;
-	// prefix byte: the byte containing the leading bits of the pixel
-	int numPrefixShifts = 8 - fpbi->startIndexOffset;
-	char prefixMask = (1 << numPrefixShifts) - 1;
-	char suffixMask = ~((1 << numSuffixShifts) - 1);
-	if(fbpm->pixelMatrix[fpbi->pixelIndex].isFG)
-	{
-		// AND mask to turn pixel black
-		prefixMask = ~prefixMask;
-		suffixMask = ~suffixMask;
-		fbDest[fpbi->byteStartIndex] &= prefixMask;
-		fbDest[fpbi->byteEndIndex] &= suffixMask;
+		ts->tv_sec = virtualClockNs / 1000000000;
+		ts->tv_nsec = virtualClockNs % 1000000000;
 	}
 	else
 	{
-		// OR mask to turn pixel white
-		fbDest[fpbi->byteStartIndex] |= prefixMask;
-		fbDest[fpbi->byteEndIndex] |= suffixMask;
-	}
-	// the pixel occupies three or more bytes
-	if(fpbi->byteRange >= 2)
-	{
-		// fill the middle byte(s)
-		char color = fbpm->pixelMatrix[fpbi->pixelIndex].isFG ? 0x00 : 0xFF;
-		memset(&fbDest[fpbi->byteStartIndex + 1], color, fpbi->byteRange - 1);
+		clock_gettime(CLOCK_MONOTONIC, ts);
 	}
 }
 
 /**
- * Write pixel matrix information into the memory mapped frame buffer.
- * Param fbDest: the memory map location of the frame buffer.
- * Param fbpm: frame buffer info + pixel matrix.
+ * Trace writer thread body. Sleeps until a batch of records is flushed, then writes it to the file.
+ * Param arg: pointer to the recorder.
+ * Return NULL.
  */
-void writeToFrameBuffer(char* fbDest, const struct FrameBufferPixelMatrix* fbpm)
+void* writeTraceLoop(void* arg)
 {
-	struct FramePixelBitInfo fpbi;
-
-	for(unsigned row = 0; row < fbpm->fbInfo.screenHeight; ++row)
+	struct TraceRecorder* recorder = arg;
+	uint64_t requests;
+	uint32_t head = recorder->head;
+	uint32_t tail;
+	uint32_t numRecords;
+	bool isQuit = false;
+	while(!isQuit)
 	{
-		fpbi.rowStartBit = row * fbpm->fbInfo.lineLength * 8;
-		for(unsigned col = 0; col < fbpm->fbInfo.screenWidth; ++col)
+		// every flush since the last wake up is served by at most two writes
+		if(read(recorder->eventFd, &requests, sizeof(requests)) > 0)
 		{
-			// determine the index of this pixel in the pixel matrix
-			fpbi.pixelIndex = row * fbpm->fbInfo.screenWidth + col;
-			// only proceed if the pixel needs to be drawn
-			if(fbpm->pixelMatrix[fpbi.pixelIndex].drawFlag)
+			isQuit = __atomic_load_n(&recorder->isQuit, __ATOMIC_ACQUIRE);
+			tail = __atomic_load_n(&recorder->tail, __ATOMIC_ACQUIRE);
+			while(head != tail)
 			{
-				fpbi.bitStartIndex = fpbi.rowStartBit + col * fbpm->fbInfo.bitsPP;
-				fpbi.bitEndIndex = fpbi.rowStartBit + (col + 1) * fbpm->fbInfo.bitsPP - 1;
-				fpbi.byteStartIndex = fpbi.bitStartIndex / 8;
-				fpbi.startIndexOffset = fpbi.bitStartIndex % 8;
-				fpbi.byteEndIndex = fpbi.bitEndIndex / 8;
-				fpbi.endIndexOffset = fpbi.bitEndIndex % 8;
-				fpbi.byteRange = fpbi.byteEndIndex - fpbi.byteStartIndex;
-
-				if(fpbi.byteRange == 0)
+				// up to the end of the ring, then the part that wrapped around
+				numRecords = TRACE_BUFFER_SIZE - (head & (TRACE_BUFFER_SIZE - 1));
+				if(numRecords > tail - head)
 				{
-					// the pixel occupies a single byte
-					writeFbSingleByte(fbDest, fbpm, &fpbi);
+					numRecords = tail - head;
 				}
-				else
+				if(write(recorder->fd, &recorder->records[head & (TRACE_BUFFER_SIZE - 1)], 
+					numRecords * sizeof(struct TraceRecord)) < 0)
 				{
-					// the pixel occupies two or more bytes
-					// assume that the pixel does not occupy more than one row
-					writeFbMultiByte(fbDest, fbpm, &fpbi);
+					printf("Error writing trace file. Dropped %u events\n", numRecords);
 				}
-				// unset the draw flag
-				fbpm->pixelMatrix[fpbi.pixelIndex].drawFlag = false;
+				head += numRecords;
+				// hand the slots back only after they are written
+				__atomic_store_n(&recorder->head, head, __ATOMIC_RELEASE);
 			}
 		}
 	}
+	return NULL;
 }
 
 /**
- * Update a pixel in the pixel matrix.
- * Param row: row of the pixel in the matrix.
- * Param col: column of the pixel in the matrix.
- * Param isFG: if true, foreground pixel.
- * Param fbpm: frame buffer info + pixel matrix.
+ * Start recording input events. An existing file is replaced.
+ * Param path: file path of the trace.
+ * Param recorder: pointer to the recorder.
+ * Return true if the trace file was created and the writer thread started.
  */
-void setPixel(
-	int row, 
-	int col, 
-	bool isFG, 
-	const struct FrameBufferPixelMatrix* fbpm)
+bool openTraceRecorder(const char* path, struct TraceRecorder* recorder)
 {
-	int index = row * fbpm->fbInfo.screenWidth + col;
-	// check if the pixel's current color differs from its desired color
-	if(fbpm->pixelMatrix[index].isFG != isFG)
+	bool success;
+	struct TraceHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = TRACE_MAGIC;
+	header.version = TRACE_VERSION;
+	header.recordSize = sizeof(struct TraceRecord);
+	memset(recorder, 0, sizeof(*recorder));
+	recorder->eventFd = -1;
+	recorder->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(!(success = recorder->fd >= 0 && write(recorder->fd, &header, sizeof(header)) == sizeof(header)))
 	{
-		fbpm->pixelMatrix[index].isFG = isFG;
-		fbpm->pixelMatrix[index].drawFlag = true;
+		printf("Error creating trace file\n");
 	}
-}
-
-/**
- * Draw a given bitmap somewhere on the pixel matrix.
- * Param bitmap: the bitmap to draw.
- * Param tFormat: position and scale of the bitmap.
- * Param fbpm: frame buffer info + pixel matrix.
- */
-void drawBitMap(
-	const char* bitmap[BITMAP_WIDTH + 1], 
-	const struct TextFormat* tFormat,
-	const struct FrameBufferPixelMatrix* fbpm)
-{
-	bool isFg;
-	unsigned currY;
-	unsigned currX;
-	for(int bitRow = 0; bitRow < BITMAP_HEIGHT; ++bitRow)
+	else if(!(success = (recorder->records = malloc(TRACE_BUFFER_SIZE * sizeof(struct TraceRecord)))
+		&& (recorder->eventFd = eventfd(0, EFD_CLOEXEC)) >= 0
+		&& startThread(&recorder->thread, writeTraceLoop, recorder)))
+	{
+		printf("Error starting the trace thread\n");
+	}
+	if(!success)
 	{
-		for(int bitCol = 0; bitCol < BITMAP_WIDTH; ++bitCol)
+		if(recorder->eventFd >= 0)
 		{
-			// space char means its a background pixel
-			isFg = bitmap[bitRow][bitCol] != ' ';
-			// subRow: the row of pixels inside of one bitmap bit
-			for(int subRow = 0; subRow < tFormat->scale; ++subRow)
-			{
-				currY = tFormat->posY + bitRow * tFormat->scale + subRow;
-				if(currY < fbpm->fbInfo.screenHeight)
-				{
-					// subCol: the column of pixels inside of one bitmap bit
-					for(int subCol = 0; subCol < tFormat->scale; ++subCol)
-					{
-						currX = tFormat->posX + bitCol * tFormat->scale + subCol;
-						if(currX < fbpm->fbInfo.screenWidth)
-						{
-							setPixel(currY, currX, isFg, fbpm);
-						}
-					}
-				}
-			}
+			close(recorder->eventFd);
 		}
+		if(recorder->fd >= 0)
+		{
+			close(recorder->fd);
+		}
+		free(recorder->records);
+		recorder->records = NULL;
+		recorder->fd = -1;
 	}
+	return success;
 }
 
 /**
- * Draw a string of characters on a given pixel matrix.
- * Param str: the string to draw.
- * Param tFormat: text formatting of the string.
- * Param fbpm: frame buffer info + pixel matrix.
+ * Hand the records added since the last call to the writer thread. Never waits for the file.
+ * Param recorder: pointer to the recorder. Nothing happens if not recording.
  */
-void drawString(
-	char* str, 
-	const struct TextFormat* tFormat, 
-	const struct FrameBufferPixelMatrix* fbpm)
+void flushTrace(struct TraceRecorder* recorder)
 {
-	int len = strlen(str);
-	unsigned xOffset;
-	const char** bitMapToDraw;
-	bool inBounds = true;
-	// character text formatting
-	struct TextFormat charFormat;
-
-	// loop through characters in the string
-	for(int i = 0; i < len && inBounds; ++i)
+	const uint64_t ONE = 1;
+	if(recorder->fd >= 0 && recorder->tail != __atomic_load_n(&recorder->head, __ATOMIC_ACQUIRE))
 	{
-		xOffset = tFormat->posX + i * tFormat->scale * (BITMAP_WIDTH + BITMAP_SPACE);
-		// top left corner of character bitmap must be onscreen
-		if((inBounds = xOffset < fbpm->fbInfo.screenWidth))
+		// the counter cannot realistically overflow, so this write never blocks
+		if(write(recorder->eventFd, &ONE, sizeof(ONE)) < 0)
 		{
-			switch(str[i])
-			{
-				case '0':
-					bitMapToDraw = BITMAP_ZERO;
-					break;
-				case '1':
-					bitMapToDraw = BITMAP_ONE;
-					break;
-				case '2':
-					bitMapToDraw = BITMAP_TWO;
-					break;
-				case '3':
-					bitMapToDraw = BITMAP_THREE;
-					break;
-				case '4':
-					bitMapToDraw = BITMAP_FOUR;
-					break;
-				case '5':
-					bitMapToDraw = BITMAP_FIVE;
-					break;
-				case '6':
-					bitMapToDraw = BITMAP_SIX;
-					break;
-				case '7':
-					bitMapToDraw = BITMAP_SEVEN;
-					break;
-				case '8':
-					bitMapToDraw = BITMAP_EIGHT;
-					break;
-				case '9':
-					bitMapToDraw = BITMAP_NINE;
-					break;
-				case ':':
-					bitMapToDraw = BITMAP_COLON;
-					break;
-				case '.':
-					bitMapToDraw = BITMAP_PERIOD;
-					break;
-				default:
-					bitMapToDraw = BITMAP_X;
-					break;
-			}
-			initTextFormat(&charFormat, tFormat->posY, xOffset, tFormat->scale);
-			drawBitMap(bitMapToDraw, &charFormat, fbpm);
+			printf("Error waking up the trace thread\n");
 		}
 	}
 }
 
-/////////////////////////////////////////////////////////////////////////
-/// INIT FUNCTIONS
-/////////////////////////////////////////////////////////////////////////
-
 /**
- * Prevent terminal text from appearing onscreen.
- * return true if graphics mode was successfully enabled.
- * See https://github.com/ev3dev/ev3dev/issues/1643#issuecomment-2237762929
+ * Add an input event to the trace. The event is dropped if the ring is full,
+ * except during a replay, which waits for the writer thread rather than lose a record.
+ * Param recorder: pointer to the recorder. Nothing happens if not recording.
+ * Param event: pointer to the event.
+ * Param device: index of the input device that delivered the event.
+ * Param hasMonotonicTime: true if the device stamps events with CLOCK_MONOTONIC.
+ * Param readNs: the moment the event was read.
  */
-bool enableGraphicsMode()
+void recordTrace(
+	struct TraceRecorder* recorder, 
+	const struct InputEvent* event, 
+	int device, 
+	bool hasMonotonicTime, 
+	int64_t readNs)
 {
-	bool success;
-	// Get the file descriptor for the virtual terminal 
-	// (started when using 'brickrun' from SSH, or when running program from the brick)
-    int fd = open("/dev/tty", O_RDWR);
-    if ((success = fd >= 0))
-	{
-    	// Set the virtual terminal to "graphics mode", 
-		// to prevent terminal text from showing up on the screen
-    	success = !ioctl(fd, KDSETMODE, KD_GRAPHICS);
-		close(fd);
-	}
-	else
+	uint32_t tail = recorder->tail;
+	struct TraceRecord* record;
+	if(recorder->fd >= 0)
 	{
-        printf("Error opening tty descriptor\n");
+		if(virtualClockNs >= 0)
+		{
+			// the virtual clock does not move while waiting, so no event is late for it
+			while(tail - __atomic_load_n(&recorder->head, __ATOMIC_ACQUIRE) == TRACE_BUFFER_SIZE)
+			{
+				flushTrace(recorder);
+				sched_yield();
+			}
+		}
+		if(tail - __atomic_load_n(&recorder->head, __ATOMIC_ACQUIRE) == TRACE_BUFFER_SIZE)
+		{
+			++recorder->numDropped;
+		}
+		else
+		{
+			record = &recorder->records[tail & (TRACE_BUFFER_SIZE - 1)];
+			memset(record, 0, sizeof(*record));
+			record->readNs = readNs;
+			record->eventSec = event->time.tv_sec;
+			record->eventUsec = event->time.tv_usec;
+			record->type = event->type;
+			record->code = event->code;
+			record->value = event->value;
+			record->device = device;
+			record->flags = hasMonotonicTime ? TRACE_MONOTONIC : 0;
+			// publish the record only after it is written
+			__atomic_store_n(&recorder->tail, tail + 1, __ATOMIC_RELEASE);
+		}
 	}
-	return success;
 }
 
 /**
- * Memory map the frame buffer file.
- * Param fbInfo: pointer to frame buffer info.
- * Param fbDest: pointer to pointer of memory map location.
- * return true if memory mapping was successful.
+ * Stop the writer thread once it has written out the rest of the trace, and close the file.
+ * Param recorder: pointer to the recorder. Nothing happens if not recording.
  */
-bool setupMmap(const struct FrameBufferInfo* fbInfo, char** fbDest)
+void closeTraceRecorder(struct TraceRecorder* recorder)
 {
-	bool success;
-	int fd = open("/dev/fb0", O_RDWR | O_CLOEXEC);
-	if((success = fd >= 0))
+	const uint64_t ONE = 1;
+	if(recorder->fd >= 0)
 	{
-		// memory map the frame buffer
-		*fbDest = mmap(0, fbInfo->size, PROT_WRITE, MAP_SHARED, fd, 0);
-		if((success = *fbDest != MAP_FAILED))
+		__atomic_store_n(&recorder->isQuit, true, __ATOMIC_RELEASE);
+		if(write(recorder->eventFd, &ONE, sizeof(ONE)) < 0)
 		{
-			// clear frame buffer before use
-			memset(*fbDest, 0xFF, fbInfo->size);
+			printf("Error waking up the trace thread\n");
 		}
-		else
+		pthread_join(recorder->thread, NULL);
+		if(recorder->numDropped > 0)
 		{
-		    printf("Error creating memory map\n");
+			printf("Trace buffer full. Dropped %u events\n", recorder->numDropped);
 		}
-		close(fd);
-	}
-	else
-	{
-        printf("Error opening framebuffer device\n");
+		close(recorder->eventFd);
+		close(recorder->fd);
+		free(recorder->records);
+		recorder->records = NULL;
+		recorder->fd = -1;
 	}
-	return success;
 }
 
 /**
- * Read frame buffer info using ioctl and write into a given struct.
- * param fbInfo: Frame buffer info is written into this struct.
- * return: True if all info was successfully written into struct.
- * See https://stackoverflow.com/q/75412675
+ * Map a trace file for playback and move the virtual clock to its first event.
+ * From now on the timer runs on the virtual clock.
+ * Param path: file path of the trace.
+ * Param isFast: if true, play back as fast as possible instead of in real time.
+ * Param replay: pointer to the replay.
+ * Return true if the trace was mapped.
  */
-bool loadFrameValues(struct FrameBufferInfo* fbInfo)
+bool openReplay(const char* path, bool isFast, struct Replay* replay)
 {
-	bool success = true;
-	struct fb_fix_screeninfo fb_fix;
-	struct fb_var_screeninfo fb_var;
-	int fd = open("/dev/fb0", O_RDWR | O_CLOEXEC);
-    if ((success = fd >= 0))
+	bool success = false;
+	const struct TraceHeader* header;
+	struct stat fileStat;
+	void* mem;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd >= 0 && !fstat(fd, &fileStat) && fileStat.st_size >= (off_t)sizeof(struct TraceHeader))
 	{
-	    // Get fixed info about fb
-	    if ((success = !ioctl(fd,FBIOGET_FSCREENINFO,&fb_fix)))
+		mem = mmap(0, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(mem != MAP_FAILED)
 		{
-	    	// Get variable info about fb
-	    	if ((success = !ioctl(fd,FBIOGET_VSCREENINFO,&fb_var)))
+			header = mem;
+			if((success = header->magic == TRACE_MAGIC && header->version == TRACE_VERSION 
+				&& header->recordSize == sizeof(struct TraceRecord)))
 			{
-				fbInfo->size = fb_fix.smem_len;
-				fbInfo->lineLength = fb_fix.line_length;
-				fbInfo->screenWidth = fb_var.xres;
-				fbInfo->screenHeight = fb_var.yres;
-				fbInfo->bitsPP = fb_var.bits_per_pixel;
-	    	}
+				memset(replay, 0, sizeof(*replay));
+				replay->mem = mem;
+				replay->size = fileStat.st_size;
+				replay->records = (const struct TraceRecord*)(header + 1);
+				replay->numRecords = (fileStat.st_size - sizeof(*header)) / sizeof(struct TraceRecord);
+				replay->isFast = isFast;
+				replay->traceStartNs = replay->numRecords > 0 ? replay->records[0].readNs : 0;
+				virtualClockNs = replay->traceStartNs;
+			}
 			else
 			{
-	    	    printf("Error reading variable FB information\n");
+				munmap(mem, fileStat.st_size);
 			}
-	    }
-		else
-		{
-	        printf("Error reading fixed FB information\n");
 		}
-		close(fd);
-    }
-	else
+	}
+	if(!success)
 	{
-        printf("Error opening framebuffer descriptor\n");
+		printf("Error opening trace file\n");
+	}
+	if(fd >= 0)
+	{
+		close(fd);
 	}
 	return success;
 }
 
-/////////////////////////////////////////////////////////////////////////
-/// PROCESS FUNCTIONS
-/////////////////////////////////////////////////////////////////////////
-
 /**
- * Perform calculations based on timer state.
- * Param state: current state of the timer.
- * Param elapsedNs: current time value of the timer.
- * Param titleFormat: text formatting for timer string.
- * Param fbDest: frame buffer memory map location. 
- * Param fbpm: frame buffer info + pixel matrix.
+ * Get the next moment the replay has something to do: a trace event or a redraw deadline.
+ * Param replay: pointer to the replay.
+ * Return the moment on the virtual clock. Never earlier than the virtual clock.
  */
-void processTimer(
-	enum TimerState* state, 
-	int64_t* elapsedNs, 
-	const struct TextFormat* titleFormat, 
-	char* fbDest, 
-	const struct FrameBufferPixelMatrix* fbpm)
+int64_t getReplayWakeupNs(const struct Replay* replay)
 {
-	// timestamps that persist between function calls
-	static struct timespec prevTs, currTs, drawTs;
-	static char strBuf[BUF_SIZE];
+	int64_t wakeupNs = replay->next < replay->numRecords ? replay->records[replay->next].readNs : virtualClockNs;
+	if(replay->redrawNs && replay->redrawNs < wakeupNs)
+	{
+		wakeupNs = replay->redrawNs;
+	}
+	return wakeupNs > virtualClockNs ? wakeupNs : virtualClockNs;
+}
 
-	if(*state != PAUSED)
+/**
+ * Get how long the main loop may sleep before the next replay wakeup.
+ * Param replay: pointer to the replay. The playback starts with the first call.
+ * Return the time to sleep in milliseconds, rounded up. 0 when playing back as fast as possible.
+ */
+int getReplayTimeoutMs(struct Replay* replay)
+{
+	struct timespec nowTs;
+	int64_t nowNs;
+	int64_t waitNs;
+	int timeoutMs = 0;
+	if(!replay->isFast)
 	{
-		if(*state == STARTED)
+		clock_gettime(CLOCK_MONOTONIC, &nowTs);
+		nowNs = (int64_t)nowTs.tv_sec * 1000000000 + nowTs.tv_nsec;
+		if(!replay->startNs)
 		{
-			*state = RUNNING;
-			// bring previous timestamp up to date
-			clock_gettime(CLOCK_MONOTONIC, &prevTs);
-			drawTs = prevTs;
-		}
-		else
-		{
-			clock_gettime(CLOCK_MONOTONIC, &currTs);
-			*elapsedNs += diffTimespecNs(currTs, prevTs);
-			// check if its time to draw
-			if(diffTimespecNs(currTs, drawTs) >= DRAW_NS)
-			{
-				nsToString(*elapsedNs, strBuf, BUF_SIZE);
-				drawString(strBuf, titleFormat, fbpm);
-				writeToFrameBuffer(fbDest, fbpm);
-				drawTs = currTs;
-			}
-			prevTs = currTs;
+			replay->startNs = nowNs;
 		}
+		waitNs = replay->startNs + getReplayWakeupNs(replay) - replay->traceStartNs - nowNs;
+		timeoutMs = waitNs > 0 ? (waitNs + 999999) / 1000000 : 0;
 	}
+	return timeoutMs;
 }
 
 /**
- * Read and process input events.
- * Param state: current state of the timer.
- * Param elapsedNs: current timer value.
- * Param titleFormat: text formatting for timer title.
- * Param splitFormat: text formatting for split timestamp.
- * Param inputFd: file descriptor for input event file.
- * Param fbDest: frame buffer memory map location.
- * Param fbpm: frame buffer info + pixel matrix.
- * Return true if the user wants to quit.
+ * Move the virtual clock to the next replay wakeup.
+ * Like the redraw timer, missed redraw deadlines are merged into one redraw.
+ * Param replay: pointer to the replay.
+ * Param isTraceDue: receives true if trace events are due, or if the trace has ended.
+ * Return true if a redraw deadline was reached.
  */
-bool pollInput(
-	enum TimerState* state, 
-	int64_t* elapsedNs, 
-	const struct TextFormat* titleFormat,
-	const struct TextFormat* splitFormat, 
-	int inputFd, 
-	char* fbDest, 
-	const struct FrameBufferPixelMatrix* fbpm)
+bool advanceReplay(struct Replay* replay, bool* isTraceDue)
 {
-	static char strBuf[BUF_SIZE];
-	static int64_t splits[MAX_SPLITS];
-	static int nextSplitIndex = 0;
-	enum Button btnCode = readInputEvent(inputFd);
-	bool isExit = false;
+	bool isRedrawDue = false;
+	virtualClockNs = getReplayWakeupNs(replay);
+	if(replay->redrawNs && replay->redrawNs <= virtualClockNs)
+	{
+		isRedrawDue = true;
+		replay->redrawNs += ((virtualClockNs - replay->redrawNs) / DRAW_NS + 1) * DRAW_NS;
+		++replay->redraws;
+	}
+	*isTraceDue = replay->next >= replay->numRecords || replay->records[replay->next].readNs <= virtualClockNs;
+	return isRedrawDue;
+}
 
-	switch(btnCode)
+/**
+ * Unmap the trace and go back to the real clock.
+ * Param replay: pointer to the replay. Nothing happens if not replaying.
+ */
+void closeReplay(struct Replay* replay)
+{
+	if(replay->mem)
 	{
-		case BACKSPACE:
-			isExit = true;
-			break;
-		case ENTER:
-			if(*state == PAUSED)
-			{
-				*state = STARTED;
-			}
-			else
-			{
-				nsToString(*elapsedNs, strBuf, BUF_SIZE);
-				drawString(strBuf, titleFormat, fbpm);
-				writeToFrameBuffer(fbDest, fbpm);
-				*state = PAUSED;
-			}
-			break;
-		case UP:
-			// TODO view previous split
-			break;
-		case DOWN:
-			// TODO view next split
-			break;
-		case LEFT:
-			if(*state == PAUSED)
-			{
-				*elapsedNs = 0;
-				nextSplitIndex = 0;
-				nsToString(0, strBuf, BUF_SIZE);
-				drawString(strBuf, titleFormat, fbpm);
-				drawString(strBuf, splitFormat, fbpm);
-				writeToFrameBuffer(fbDest, fbpm);
-			}
-			break;
-		case RIGHT:
-			if(*state == RUNNING)
-			{
-				splits[nextSplitIndex] = *elapsedNs;
-				nsToString(splits[nextSplitIndex], strBuf, BUF_SIZE);
-				drawString(strBuf, splitFormat, fbpm);
-				writeToFrameBuffer(fbDest, fbpm);
-				nextSplitIndex = (nextSplitIndex + 1) % MAX_SPLITS;
-			}
-			break;
-		default:
-			// do nothing
-			break;
+		munmap(replay->mem, replay->size);
+		replay->mem = NULL;
+		virtualClockNs = -1;
 	}
-	return isExit;
 }
 
 /////////////////////////////////////////////////////////////////////////
-/// MAIN FUNCTIONS
+/// INPUT FUNCTIONS
 /////////////////////////////////////////////////////////////////////////
 
 /**
- * Main processing loop.
- * Param fbInfo: pointer to frame buffer info.
- * Param fbDest: pointer to memory mapped frame buffer.
- * Param inputFd: file descriptor for input events file.
+ * Compare two timestamps.
+ * Param a: pointer to the first timestamp.
+ * Param b: pointer to the second timestamp.
+ * Return true if a is later than b.
  */
-void performMainLoop(struct FrameBufferInfo* fbInfo, char* fbDest, int inputFd)
+static inline bool isLater(const struct timespec* a, const struct timespec* b)
 {
-	static char strBuf[BUF_SIZE];
-	enum TimerState state = PAUSED;
-	struct MonoPixelElement pixelMatrix[fbInfo->screenHeight * fbInfo->screenWidth];
-	struct TextFormat titleFormat, splitFormat;
-	struct FrameBufferPixelMatrix fbpm;
-	int64_t elapsedNs = 0;
-	bool isExit = false;
-
-	// pre-loop inits
-	memset(pixelMatrix, 0, sizeof(pixelMatrix));
-	nsToString(0, strBuf, BUF_SIZE);
-	// frame buffer info is copied into fbpm struct
-	initFrameBufferPixelMatrix(&fbpm, fbInfo, pixelMatrix);
-	initTextFormat(&titleFormat, 16, 16, 3);
-	initTextFormat(&splitFormat, 48, 16, 2);
-	drawString(strBuf, &titleFormat, &fbpm);
-	drawString(strBuf, &splitFormat, &fbpm);
-	writeToFrameBuffer(fbDest, &fbpm);
-
-	do
-	{
-		processTimer(&state, &elapsedNs, &titleFormat, fbDest, &fbpm);
-		// one tick per millisecond
-		usleep(1000);
-		isExit = pollInput(&state, &elapsedNs, &titleFormat, &splitFormat, 
-			inputFd, fbDest, &fbpm);
-	} while(!isExit);
+	return a->tv_sec > b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
 }
 
 /**
- * Perform initializations on the given pointers.
- * Param fbInfo: pointer to frame buffer info struct.
- * Param fbDest: pointer to a pointer to the memory mapped frame buffer destination.
- * Param inputFd: pointer to the input event file descriptor.
- * Return true if initialization was a success.
+ * Add a button press to an input queue, keeping the queue ordered by time.
+ * Presses of one source arrive in order, so the search from the back is usually a single step.
+ * Param queue: pointer to the input queue.
+ * Param press: pointer to the press to add.
+ * Return true if the press was added. False if the queue is full.
  */
-bool initMain(struct FrameBufferInfo* fbInfo, char** fbDest, int* inputFd)
+bool pushButtonPress(struct InputQueue* queue, const struct ButtonPress* press)
 {
 	bool success;
-	// enable graphics mode
-	if((success = enableGraphicsMode()))
+	int pos;
+	if((success = queue->count < INPUT_QUEUE_SIZE))
 	{
-		// obtain the input event file descriptor
-    	*inputFd = open("/dev/input/by-path/platform-gpio_keys-event", O_RDONLY | O_NONBLOCK);
-		if((success = *inputFd >= 0))
+		pos = queue->count;
+		// move later presses of other sources back by one
+		while(pos > 0 && isLater(&queue->presses[(queue->head + pos - 1) % INPUT_QUEUE_SIZE].time, &press->time))
 		{
-			// load frame buffer values into struct
-			if((success = loadFrameValues(fbInfo)))
-			{
-				// setup memory map
-				success = setupMmap(fbInfo, fbDest);
-			}
+			queue->presses[(queue->head + pos) % INPUT_QUEUE_SIZE] = 
+				queue->presses[(queue->head + pos - 1) % INPUT_QUEUE_SIZE];
+			--pos;
 		}
+		queue->presses[(queue->head + pos) % INPUT_QUEUE_SIZE] = *press;
+		++queue->count;
 	}
 	return success;
 }
 
-int main(int argc, char** argv)
+/**
+ * Remove the button press at the front of an input queue.
+ * Param queue: pointer to the input queue.
+ * Param press: receives the removed press.
+ * Return true if a press was removed. False if the queue is empty.
+ */
+bool popButtonPress(struct InputQueue* queue, struct ButtonPress* press)
 {
-	(void)argc;
-	(void)argv;
-
 	bool success;
-	struct FrameBufferInfo fbInfo;
-	int inputFd;
-	char* fbDest;
-
-	if((success = ev3_init() >= 1))
+	if((success = queue->count > 0))
 	{
-		if((success = initMain(&fbInfo, &fbDest, &inputFd)))
-		{
-			performMainLoop(&fbInfo, fbDest, inputFd);
-		}
-		else
-		{
-			printf("Main init failed\n");
+		*press = queue->presses[queue->head];
+		queue->head = (queue->head + 1) % INPUT_QUEUE_SIZE;
+		--queue->count;
+	}
+	return success;
+}
+
+/**
+ * Queue the action of an input event if it is a button press of a mapped key.
+ * Param event: pointer to the event.
+ * Param hasMonotonicTime: true if the event is stamped with CLOCK_MONOTONIC.
+ * Param readTs: the moment the event was read. The press time of events without a monotonic stamp.
+ * Param keyActions: the enum Action of every key code.
+ * Param queue: pointer to the queue that receives the press.
+ * Return true if a press was queued.
+ */
+bool queueInputEvent(
+	const struct InputEvent* event, 
+	bool hasMonotonicTime, 
+	const struct timespec* readTs, 
+	const uint8_t* keyActions, 
+	struct InputQueue* queue)
+{
+	struct ButtonPress press;
+	bool isQueued = false;
+	// event must be a button press (not a release) of a mapped key
+	if(event->type == EV_KEY && event->value == 1 && event->code < KEY_CNT
+		&& keyActions[event->code] != ACTION_NONE)
+	{
+		press.action = keyActions[event->code];
+		press.command = -1;
+		if(hasMonotonicTime)
+		{
+			// the exact moment the kernel saw the press
+			press.time.tv_sec = event->time.tv_sec;
+			press.time.tv_nsec = event->time.tv_usec * 1000;
+		}
+		else
+		{
+			press.time = *readTs;
+		}
+		if(!(isQueued = pushButtonPress(queue, &press)))
+		{
+			printf("Input queue full. Dropped a button press\n");
+		}
+	}
+	return isQueued;
+}
+
+/**
+ * Take the trace events that are due on the virtual clock, as if they had just been read.
+ * Param sources: pointer to the input sources.
+ * Param queue: pointer to the queue that receives the presses.
+ * Return the number of presses queued. -1 if the trace has ended.
+ */
+int replayInputEvents(struct InputSources* sources, struct InputQueue* queue)
+{
+	struct Replay* replay = &sources->replay;
+	const struct TraceRecord* record;
+	struct InputEvent iEvent;
+	struct timespec readTs;
+	int numQueued = replay->next < replay->numRecords ? 0 : -1;
+	// every record makes at most one press. the rest stays due for the next wakeup
+	while(replay->next < replay->numRecords && replay->records[replay->next].readNs <= virtualClockNs
+		&& queue->count < INPUT_QUEUE_SIZE)
+	{
+		record = &replay->records[replay->next++];
+		iEvent.time.tv_sec = record->eventSec;
+		iEvent.time.tv_usec = record->eventUsec;
+		iEvent.type = record->type;
+		iEvent.code = record->code;
+		iEvent.value = record->value;
+		readTs.tv_sec = record->readNs / 1000000000;
+		readTs.tv_nsec = record->readNs % 1000000000;
+		recordTrace(&sources->recorder, &iEvent, record->device, record->flags & TRACE_MONOTONIC, record->readNs);
+		numQueued += queueInputEvent(&iEvent, record->flags & TRACE_MONOTONIC, &readTs, sources->keyActions, queue);
+	}
+	return numQueued;
+}
+
+/**
+ * Drain an input event file and queue the action of every button press with its timestamp.
+ * Keys without an action are dropped here. Every event read is recorded if a trace is recorded.
+ * Param sources: pointer to the input sources.
+ * Param index: index of the input device.
+ * Param queue: pointer to the queue that receives the presses.
+ * Return the number of presses queued. -1 if the end of the input was reached.
+ */
+int readInputEvents(struct InputSources* sources, int index, struct InputQueue* queue)
+{
+	struct InputDevice* device = &sources->devices[index];
+	struct InputEvent iEvents[MAX_READ_EVENTS];
+	int numBufBytes;
+	struct timespec readTs = {0, 0};
+	ssize_t numBytes;
+	int numEvents;
+	int maxEvents;
+	int numQueued = 0;
+	if(device->isTrace)
+	{
+		numQueued = replayInputEvents(sources, queue);
+	}
+	else
+	{
+		// the event clock may not be comparable with ours. a trace needs the read time either way
+		if(!device->hasMonotonicTime || sources->recorder.fd >= 0)
+		{
+			getTimerClock(&readTs);
+		}
+		do
+		{
+			// take as many events as the kernel has in a single call, but never more than the
+			// queue has room for. every event makes at most one press, so none is dropped.
+			// the rest stays in the kernel or file until the queue has been processed
+			maxEvents = INPUT_QUEUE_SIZE - queue->count;
+			maxEvents = maxEvents < MAX_READ_EVENTS ? maxEvents : MAX_READ_EVENTS;
+			// a pipe may split an event across reads. its start goes in front of the new bytes
+			memcpy(iEvents, device->partial, device->partialBytes);
+			numBytes = maxEvents > 0 ? read(device->fd, (char*)iEvents + device->partialBytes, 
+				maxEvents * sizeof(struct InputEvent) - device->partialBytes) : -1;
+			numBufBytes = device->partialBytes + (numBytes > 0 ? numBytes : 0);
+			numEvents = numBufBytes / sizeof(struct InputEvent);
+			device->partialBytes = numBufBytes % sizeof(struct InputEvent);
+			memcpy(device->partial, (char*)iEvents + numEvents * sizeof(struct InputEvent), 
+				device->partialBytes);
+			for(int i = 0; i < numEvents; ++i)
+			{
+				recordTrace(&sources->recorder, &iEvents[i], index, device->hasMonotonicTime, 
+					(int64_t)readTs.tv_sec * 1000000000 + readTs.tv_nsec);
+				numQueued += queueInputEvent(&iEvents[i], device->hasMonotonicTime, &readTs, 
+					sources->keyActions, queue);
+			}
+		// a full buffer means the kernel may be holding more events
+		} while(numEvents == MAX_READ_EVENTS);
+		// only pipes and files can run out of events
+		if(numBytes == 0)
+		{
+			if(device->partialBytes > 0)
+			{
+				printf("Input ended within an event. Dropped %d bytes\n", device->partialBytes);
+			}
+			numQueued = -1;
+		}
+	}
+	return numQueued;
+}
+
+/**
+ * Command line names of the actions, in order of enum Action.
+ */
+static const char* ACTION_NAMES[ACTION_COUNT] = {
+	"none", "quit", "start-stop", "start", "stop", "split", "reset", "prev", "next"};
+
+/**
+ * Map the brick buttons and touch sensors to their default actions.
+ * Param keyActions: the enum Action of every key code.
+ */
+void initKeyActions(uint8_t* keyActions)
+{
+	memset(keyActions, ACTION_NONE, KEY_CNT);
+	keyActions[BACKSPACE] = ACTION_QUIT;
+	keyActions[ENTER] = ACTION_START_STOP;
+	keyActions[UP] = ACTION_PREV_SPLIT;
+	keyActions[DOWN] = ACTION_NEXT_SPLIT;
+	keyActions[LEFT] = ACTION_RESET;
+	keyActions[RIGHT] = ACTION_SPLIT;
+	// the first touch sensor works like the center button. the others record splits
+	keyActions[TOUCH_SENSOR_KEY] = ACTION_START_STOP;
+	for(int i = 1; i < MAX_TOUCH_SENSORS; ++i)
+	{
+		keyActions[TOUCH_SENSOR_KEY + i] = ACTION_SPLIT;
+	}
+}
+
+/**
+ * Apply a key mapping of the form CODE=ACTION, e.g. 2=split.
+ * Param mapping: the mapping.
+ * Param keyActions: the enum Action of every key code.
+ * Return true if the mapping was understood.
+ */
+bool parseKeyMapping(const char* mapping, uint8_t* keyActions)
+{
+	unsigned code;
+	char name[16];
+	bool success = false;
+	if(sscanf(mapping, "%u=%15s", &code, name) == 2 && code < KEY_CNT)
+	{
+		for(int i = 0; i < ACTION_COUNT && !success; ++i)
+		{
+			if((success = !strcmp(name, ACTION_NAMES[i])))
+			{
+				keyActions[code] = i;
+			}
+		}
+	}
+	return success;
+}
+
+#ifndef STOPWATCH_NO_EV3
+/**
+ * Touch sensor thread body. Samples every touch sensor on a fixed grid and writes an
+ * InputEvent record into the sensor pipe for every new touch, so touches reach the
+ * main loop like key presses.
+ * Param arg: pointer to the input sources.
+ * Return NULL.
+ */
+void* pollTouchSensors(void* arg)
+{
+	const struct InputSources* sources = arg;
+	struct InputEvent iEvents[MAX_TOUCH_SENSORS];
+	bool isTouched[MAX_TOUCH_SENSORS] = {false};
+	struct timespec deadline;
+	struct timespec now;
+	int value;
+	int numEvents;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	while(!__atomic_load_n(&sources->isSensorQuit, __ATOMIC_ACQUIRE))
+	{
+		numEvents = 0;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for(int i = 0; i < sources->numSensors; ++i)
+		{
+			if(get_sensor_value(0, sources->sensors[i], &value))
+			{
+				// only the moment of touching counts, like a key press
+				if(value && !isTouched[i])
+				{
+					iEvents[numEvents].time.tv_sec = now.tv_sec;
+					iEvents[numEvents].time.tv_usec = now.tv_nsec / 1000;
+					iEvents[numEvents].type = EV_KEY;
+					iEvents[numEvents].code = TOUCH_SENSOR_KEY + i;
+					iEvents[numEvents].value = 1;
+					++numEvents;
+				}
+				isTouched[i] = value != 0;
+			}
+		}
+		// the pipe is non blocking. touches are dropped if the main loop falls far behind
+		if(numEvents > 0 && write(sources->sensorPipeFd, iEvents, numEvents * sizeof(struct InputEvent)) < 0)
+		{
+			printf("Touch sensor pipe full. Dropped a touch\n");
+		}
+		deadline.tv_nsec += SENSOR_POLL_NS;
+		if(deadline.tv_nsec >= 1000000000)
+		{
+			deadline.tv_nsec -= 1000000000;
+			++deadline.tv_sec;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+	}
+	return NULL;
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////
+/// TIME FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Write the decimal digits of an unsigned number to a given buffer.
+ * param n: the number.
+ * param strBuf: char array buffer with room for at least 11 chars.
+ * return the number of digits written. A null terminator is also written.
+ */
+int uintToString(uint32_t n, char* strBuf)
+{
+	char digits[10];
+	int len = 0;
+	int numDigits;
+	// collect digits from least to most significant
+	do
+	{
+		digits[len++] = '0' + n % 10;
+		n /= 10;
+	} while(n > 0);
+	numDigits = len;
+	for(int i = 0; i < numDigits; ++i)
+	{
+		strBuf[i] = digits[--len];
+	}
+	strBuf[numDigits] = '\0';
+	return numDigits;
+}
+
+/**
+ * Two ASCII digits of every number below 100.
+ */
+static const char DIGIT_PAIRS[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/**
+ * Write a character into a time string and remember if it changed.
+ * param fields: pointer to the time fields holding the string.
+ * param pos: position of the character.
+ * param c: the new character.
+ * param changed: receives a set bit at pos if the character changed.
+ */
+static inline void putTimeChar(struct TimeFields* fields, int pos, char c, CharMask* changed)
+{
+	if(fields->str[pos] != c)
+	{
+		fields->str[pos] = c;
+		*changed |= (CharMask)1 << pos;
+	}
+}
+
+/**
+ * Write the milliseconds of time fields into their string.
+ * param fields: pointer to the time fields.
+ * param changed: receives the positions of changed characters.
+ */
+static inline void putMilliseconds(struct TimeFields* fields, CharMask* changed)
+{
+	const char* pair = &DIGIT_PAIRS[(fields->ms % 100) * 2];
+	putTimeChar(fields, fields->minutesPos + 6, '0' + fields->ms / 100, changed);
+	putTimeChar(fields, fields->minutesPos + 7, pair[0], changed);
+	putTimeChar(fields, fields->minutesPos + 8, pair[1], changed);
+}
+
+/**
+ * Write the seconds and minutes of time fields into their string.
+ * param fields: pointer to the time fields.
+ * param changed: receives the positions of changed characters.
+ */
+static inline void putSecondsAndMinutes(struct TimeFields* fields, CharMask* changed)
+{
+	const char* pair = &DIGIT_PAIRS[fields->seconds * 2];
+	putTimeChar(fields, fields->minutesPos + 3, pair[0], changed);
+	putTimeChar(fields, fields->minutesPos + 4, pair[1], changed);
+	pair = &DIGIT_PAIRS[fields->minutes * 2];
+	putTimeChar(fields, fields->minutesPos, pair[0], changed);
+	putTimeChar(fields, fields->minutesPos + 1, pair[1], changed);
+}
+
+/**
+ * Set time fields to a given number of nanoseconds and rewrite their whole string
+ * with format H:MM:SS.mmm, or MM:SS.mmm below an hour.
+ * param fields: pointer to the time fields. An empty string means nothing was formatted yet.
+ * param ns: the non negative number of nanoseconds.
+ * return the positions of characters that differ from the previous string.
+ * Every position is reported when the length changed.
+ */
+CharMask setTimeFields(struct TimeFields* fields, int64_t ns)
+{
+	CharMask changed = 0;
+	int prevLen = fields->len;
+	int64_t ms = ns / 1000000;
+	int seconds = ms / 1000;
+	int minutes = seconds / 60;
+	char hoursStr[11];
+	int hoursLen = 0;
+
+	fields->ns = ns;
+	fields->subMsNs = ns % 1000000;
+	fields->ms = ms % 1000;
+	fields->seconds = seconds % 60;
+	fields->minutes = minutes % 60;
+	fields->hours = minutes / 60;
+	if(fields->hours > 0)
+	{
+		hoursLen = uintToString(fields->hours, hoursStr);
+		hoursStr[hoursLen++] = ':';
+	}
+	fields->minutesPos = hoursLen;
+	fields->len = hoursLen + 9;
+	if(fields->len != prevLen)
+	{
+		// the layout moved. report every cell of both strings
+		changed = ~(CharMask)0 >> (32 - (fields->len > prevLen ? fields->len : prevLen));
+		memset(fields->str, ' ', fields->len);
+	}
+	for(int i = 0; i < hoursLen; ++i)
+	{
+		putTimeChar(fields, i, hoursStr[i], &changed);
+	}
+	putSecondsAndMinutes(fields, &changed);
+	putTimeChar(fields, hoursLen + 2, ':', &changed);
+	putTimeChar(fields, hoursLen + 5, '.', &changed);
+	putMilliseconds(fields, &changed);
+	fields->str[fields->len] = '\0';
+	return changed;
+}
+
+/**
+ * Advance time fields by a number of nanoseconds by carrying from milliseconds upwards.
+ * Only deltas below a second are carried. Anything else falls back to setTimeFields.
+ * param fields: pointer to the time fields.
+ * param deltaNs: nanoseconds to add.
+ * return the positions of characters that changed.
+ */
+CharMask advanceTimeFields(struct TimeFields* fields, int64_t deltaNs)
+{
+	CharMask changed = 0;
+	int32_t subMsNs;
+	int32_t carryMs;
+	if(fields->len == 0 || deltaNs < 0 || deltaNs >= 1000000000)
+	{
+		changed = setTimeFields(fields, fields->ns + deltaNs);
+	}
+	else
+	{
+		fields->ns += deltaNs;
+		// below a second the sum fits in 32 bits
+		subMsNs = fields->subMsNs + (int32_t)deltaNs;
+		carryMs = subMsNs / 1000000;
+		fields->subMsNs = subMsNs - carryMs * 1000000;
+		if(carryMs > 0)
+		{
+			fields->ms += carryMs;
+			if(fields->ms >= 1000)
+			{
+				// a delta below a second carries at most one second
+				fields->ms -= 1000;
+				if(++fields->seconds == 60)
+				{
+					fields->seconds = 0;
+					if(++fields->minutes == 60)
+					{
+						fields->minutes = 0;
+						++fields->hours;
+					}
+				}
+				if(fields->minutes == 0 && fields->seconds == 0)
+				{
+					// the hours changed and may have grown a digit
+					changed = setTimeFields(fields, fields->ns);
+				}
+				else
+				{
+					putSecondsAndMinutes(fields, &changed);
+				}
+			}
+			putMilliseconds(fields, &changed);
+		}
+	}
+	return changed;
+}
+
+/**
+ * Given a positive number of nanoseconds, write
+ * a string with format HH:MM:SS.mmm to a given buffer.
+ * param ns: the number of nanoseconds.
+ * param timeStrBuf: char array buffer to be written to.
+ * param bufferSize: the size of the char array buffer in bytes.
+ * return true if the time was written to the string buffer.
+ */
+bool nsToString(int64_t ns, char* timeStrBuf, int bufferSize)
+{	
+	bool success;
+	struct TimeFields fields;
+	// buffer pointer must be non null
+	// buffer size must be at least 1
+	// milliseconds must be non negative
+	if((success = timeStrBuf && bufferSize >= 1 && ns >= 0))
+	{
+		// OUTPUT_SIZE includes null terminator
+		const int OUTPUT_SIZE = 13;
+		if((success = bufferSize >= OUTPUT_SIZE))
+		{
+			fields.len = 0;
+			setTimeFields(&fields, ns);
+			// more than 99 hours does not fit and is cut off
+			if(fields.len >= OUTPUT_SIZE)
+			{
+				fields.len = OUTPUT_SIZE - 1;
+			}
+			memcpy(timeStrBuf, fields.str, fields.len);
+			timeStrBuf[fields.len] = '\0';
+		}
+		else
+		{
+			// buffer size insufficient
+			*timeStrBuf = '\0';
+		}
+	}
+	return success;
+}
+
+/**
+ * Calculate the number of nanoseconds between two timestamps.
+ * Param after: the later timestamp.
+ * Param before: the earlier timestamp.
+ * Return the difference between the two timestamps in nanoseconds.
+ * See https://stackoverflow.com/a/64896093
+ */
+int64_t diffTimespecNs(const struct timespec after, const struct timespec before)
+{
+    return ((int64_t)after.tv_sec - (int64_t)before.tv_sec) * (int64_t)1000000000
+         + ((int64_t)after.tv_nsec - (int64_t)before.tv_nsec);
+}
+
+/**
+ * Convert a timestamp to nanoseconds.
+ * Param ts: pointer to the timestamp.
+ * Return the timestamp in nanoseconds.
+ */
+int64_t timespecToNs(const struct timespec* ts)
+{
+	return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+/**
+ * Convert nanoseconds to a timestamp. Negative values still give 0 <= tv_nsec < 1e9.
+ * Param ns: the time in nanoseconds.
+ * Param ts: pointer to the timestamp that receives the time.
+ */
+void nsToTimespec(int64_t ns, struct timespec* ts)
+{
+	int64_t sec = ns / 1000000000;
+	// division truncates towards zero. floor it instead
+	sec -= ns % 1000000000 < 0 ? 1 : 0;
+	ts->tv_sec = sec;
+	ts->tv_nsec = ns - sec * 1000000000;
+}
+
+/**
+ * Read the monotonic clock.
+ * Return the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+int64_t getMonotonicNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return timespecToNs(&ts);
+}
+
+/**
+ * Calculate the timer value at a given moment.
+ * Param timer: pointer to the timer.
+ * Param ts: the moment. Must not be earlier than the start of the current run.
+ * Return the timer value at the given moment in nanoseconds.
+ */
+int64_t getElapsedNsAt(const struct Timer* timer, const struct timespec* ts)
+{
+	int64_t elapsedNs = timer->accumulatedNs;
+	if(timer->state == RUNNING)
+	{
+		elapsedNs += diffTimespecNs(*ts, timer->startTs);
+	}
+	return elapsedNs;
+}
+
+/**
+ * Calculate the current timer value. The clock is only read while running.
+ * Param timer: pointer to the timer.
+ * Return the current timer value in nanoseconds.
+ */
+int64_t getElapsedNs(const struct Timer* timer)
+{
+	struct timespec currTs;
+	int64_t elapsedNs = timer->accumulatedNs;
+	if(timer->state == RUNNING)
+	{
+		getTimerClock(&currTs);
+		elapsedNs = getElapsedNsAt(timer, &currTs);
+	}
+	return elapsedNs;
+}
+
+/**
+ * Start a paused timer at a given moment.
+ * Param timer: pointer to the timer.
+ * Param ts: the moment the run starts.
+ */
+void startTimer(struct Timer* timer, const struct timespec* ts)
+{
+	timer->startTs = *ts;
+	timer->state = RUNNING;
+}
+
+/**
+ * Stop a running timer at a given moment and bank the time of the run.
+ * Param timer: pointer to the timer.
+ * Param ts: the moment the run stops.
+ */
+void stopTimer(struct Timer* timer, const struct timespec* ts)
+{
+	timer->accumulatedNs = getElapsedNsAt(timer, ts);
+	timer->pausedTs = *ts;
+	timer->state = PAUSED;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// LATENCY FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+// set from the SIGUSR1 handler. the main loop dumps the histograms when it sees it
+static volatile sig_atomic_t isLatencyDumpRequested = 0;
+
+/**
+ * SIGUSR1 handler. Only raises a flag.
+ * Param signum: the signal number.
+ */
+void requestLatencyDump(int signum)
+{
+	(void)signum;
+	isLatencyDumpRequested = 1;
+}
+
+/**
+ * Add a latency sample to a histogram.
+ * Param stats: pointer to the latency histograms.
+ * Param metric: the histogram to add to.
+ * Param ns: the latency in nanoseconds. Negative latencies count as 0.
+ */
+static inline void recordLatency(struct LatencyStats* stats, enum LatencyMetric metric, int64_t ns)
+{
+	struct Histogram* histogram = &stats->histograms[metric];
+	uint32_t sequence = histogram->sequence;
+	// bucket i holds [2^(i-1), 2^i). 0 ns lands in bucket 0
+	int bucket = ns > 0 ? 64 - __builtin_clzll((uint64_t)ns) : 0;
+	if(bucket >= HISTOGRAM_BUCKETS)
+	{
+		bucket = HISTOGRAM_BUCKETS - 1;
+	}
+	__atomic_store_n(&histogram->sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	++histogram->counts[bucket];
+	if(ns > histogram->maxNs)
+	{
+		histogram->maxNs = ns;
+	}
+	__atomic_store_n(&histogram->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copy a consistent snapshot of a histogram that another thread may be adding to.
+ * Retries while a sample is being added, and never makes the writer wait.
+ * Param histogram: pointer to the histogram.
+ * Param snapshot: pointer to the struct that receives the copy.
+ */
+void readHistogram(const struct Histogram* histogram, struct Histogram* snapshot)
+{
+	uint32_t before;
+	uint32_t after;
+	do
+	{
+		before = __atomic_load_n(&histogram->sequence, __ATOMIC_ACQUIRE);
+		memcpy(snapshot, histogram, sizeof(*snapshot));
+		// the copy must complete before the sequence is read again
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&histogram->sequence, __ATOMIC_RELAXED);
+	} while((before & 1) || before != after);
+}
+
+/**
+ * Print every non empty histogram bucket as a CSV row with the columns 
+ * metric,le_ns,count followed by a summary row per metric with le_ns "max".
+ * le_ns is the exclusive upper bound of the bucket, or "inf" for the last bucket.
+ * Param stats: pointer to the latency histograms.
+ */
+void printLatencyStats(const struct LatencyStats* stats)
+{
+	static const char* NAMES[LATENCY_METRIC_COUNT] = {
+		"button_to_pixel", "frame_rasterize", "frame_flush", "redraw_interval_error"};
+	struct Histogram histogram;
+	printf("metric,le_ns,count\n");
+	for(int m = 0; m < LATENCY_METRIC_COUNT; ++m)
+	{
+		readHistogram(&stats->histograms[m], &histogram);
+		for(int i = 0; i < HISTOGRAM_BUCKETS; ++i)
+		{
+			if(histogram.counts[i] > 0 && i < HISTOGRAM_BUCKETS - 1)
+			{
+				printf("%s,%llu,%llu\n", NAMES[m], 1ULL << i, 
+					(unsigned long long)histogram.counts[i]);
+			}
+			else if(histogram.counts[i] > 0)
+			{
+				printf("%s,inf,%llu\n", NAMES[m], (unsigned long long)histogram.counts[i]);
+			}
+		}
+		printf("%s,max,%lld\n", NAMES[m], (long long)histogram.maxNs);
+	}
+	fflush(stdout);
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// SHARED STATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Create the shared memory object other processes read the timer state from.
+ * Return a pointer to the mapped timer state, or NULL if it could not be created.
+ */
+struct TimerShm* setupTimerShm()
+{
+	struct TimerShm* shm = NULL;
+	void* mem;
+	int fd = shm_open(TIMER_SHM_NAME, O_RDWR | O_CREAT, 0644);
+	if(fd >= 0 && !ftruncate(fd, sizeof(struct TimerShm)))
+	{
+		mem = mmap(0, sizeof(struct TimerShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(mem != MAP_FAILED)
+		{
+			shm = mem;
+			// keep the sequence of a previous run, readers may still hold a mapping.
+			// a run killed in the middle of a publish left it odd. make it even again,
+			// or readers would take torn states as stable and stable ones as torn
+			__atomic_store_n(&shm->sequence, (shm->sequence + 1) & ~1u, __ATOMIC_RELEASE);
+			shm->version = TIMER_SHM_VERSION;
+		}
+	}
+	if(!shm)
+	{
+		printf("Error creating shared memory. The timer state is not published\n");
+	}
+	if(fd >= 0)
+	{
+		close(fd);
+	}
+	return shm;
+}
+
+/**
+ * Publish the timer state under the seqlock. Readers never block this.
+ * Param shm: pointer to the mapped timer state. Nothing happens if NULL.
+ * Param timer: pointer to the timer.
+ * Param history: pointer to the split history.
+ */
+void publishTimerState(struct TimerShm* shm, const struct Timer* timer, const struct SplitHistory* history)
+{
+	uint32_t sequence;
+	uint32_t numSplits;
+	uint32_t number;
+	if(shm)
+	{
+		sequence = shm->sequence;
+		// an odd sequence tells readers to retry
+		__atomic_store_n(&shm->sequence, sequence + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		shm->isRunning = timer->state == RUNNING;
+		shm->startNs = timespecToNs(&timer->startTs);
+		shm->accumulatedNs = timer->accumulatedNs;
+		shm->splitCount = history->total;
+		numSplits = history->total < TIMER_SHM_SPLITS ? history->total : TIMER_SHM_SPLITS;
+		for(uint32_t i = 0; i < numSplits; ++i)
+		{
+			number = history->total - i;
+			shm->splitNs[(number - 1) % TIMER_SHM_SPLITS] = history->splitNs[(number - 1) % MAX_SPLITS];
+		}
+		__atomic_store_n(&shm->sequence, sequence + 2, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * Unmap and remove the shared timer state. Readers that still map it keep the last state.
+ * Param shm: pointer to the mapped timer state. Nothing happens if NULL.
+ */
+void closeTimerShm(struct TimerShm* shm)
+{
+	if(shm)
+	{
+		munmap(shm, sizeof(struct TimerShm));
+		shm_unlink(TIMER_SHM_NAME);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// TELEMETRY FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Start without a telemetry socket or subscribers.
+ * Param telemetry: pointer to the publisher.
+ */
+void initTelemetry(struct Telemetry* telemetry)
+{
+	memset(telemetry, 0, sizeof(*telemetry));
+	telemetry->listenFd = -1;
+}
+
+/**
+ * Add a connected socket to the subscribers. The socket is made non blocking,
+ * so that a subscriber that stops reading can never stall the stopwatch.
+ * Param telemetry: pointer to the publisher.
+ * Param fd: the connected socket. Closed if there is no room for it.
+ * Return true if the socket was added.
+ */
+bool addTelemetrySubscriber(struct Telemetry* telemetry, int fd)
+{
+	bool success;
+	if((success = telemetry->numSubscribers < MAX_TELEMETRY_SUBSCRIBERS 
+		&& fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0))
+	{
+		telemetry->subscriberFds[telemetry->numSubscribers++] = fd;
+	}
+	else
+	{
+		close(fd);
+	}
+	return success;
+}
+
+/**
+ * Accept every subscriber waiting on the telemetry socket.
+ * Param telemetry: pointer to the publisher.
+ */
+void acceptTelemetrySubscribers(struct Telemetry* telemetry)
+{
+	int fd;
+	while((fd = accept4(telemetry->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		if(!addTelemetrySubscriber(telemetry, fd))
+		{
+			printf("Too many telemetry subscribers. Turned one away\n");
+		}
+	}
+}
+
+/**
+ * Send the batch to every subscriber in a single message each, then empty it.
+ * A subscriber whose socket is full misses the batch. A subscriber that hung up is dropped.
+ * Param telemetry: pointer to the publisher.
+ */
+void flushTelemetry(struct Telemetry* telemetry)
+{
+	struct TelemetryHeader header;
+	struct iovec iov[2];
+	int i = 0;
+	if(telemetry->batchSize > 0)
+	{
+		memset(&header, 0, sizeof(header));
+		header.numRecords = telemetry->batchSize;
+		header.firstIndex = telemetry->nextIndex;
+		iov[0].iov_base = &header;
+		iov[0].iov_len = sizeof(header);
+		iov[1].iov_base = telemetry->batch;
+		iov[1].iov_len = telemetry->batchSize * sizeof(struct TelemetryRecord);
+		while(i < telemetry->numSubscribers)
+		{
+			// a seqpacket message is sent whole or not at all
+			if(writev(telemetry->subscriberFds[i], iov, 2) >= 0)
+			{
+				++i;
+			}
+			else if(errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+			{
+				// the subscriber finds the gap through firstIndex
+				telemetry->shedRecords += telemetry->batchSize;
+				++i;
+			}
+			else
+			{
+				close(telemetry->subscriberFds[i]);
+				telemetry->subscriberFds[i] = telemetry->subscriberFds[--telemetry->numSubscribers];
+			}
+		}
+		telemetry->nextIndex += telemetry->batchSize;
+		telemetry->batchSize = 0;
+	}
+}
+
+/**
+ * Add a timer event to the batch. Nothing is recorded without subscribers.
+ * A full batch is flushed right away.
+ * Param telemetry: pointer to the publisher.
+ * Param type: the enum TelemetryType of the event.
+ * Param ts: the moment of the event.
+ * Param elapsedNs: the timer value at the event.
+ * Param splitCount: the number of splits recorded since the last reset.
+ */
+void queueTelemetry(
+	struct Telemetry* telemetry, 
+	enum TelemetryType type, 
+	const struct timespec* ts, 
+	int64_t elapsedNs, 
+	uint32_t splitCount)
+{
+	struct TelemetryRecord* record;
+	if(telemetry->numSubscribers > 0)
+	{
+		if(telemetry->batchSize == TELEMETRY_BATCH_SIZE)
+		{
+			flushTelemetry(telemetry);
+		}
+		record = &telemetry->batch[telemetry->batchSize++];
+		memset(record, 0, sizeof(*record));
+		record->type = type;
+		record->splitCount = splitCount;
+		record->timeNs = timespecToNs(ts);
+		record->elapsedNs = elapsedNs;
+	}
+}
+
+/**
+ * Create the telemetry socket and let the main loop accept subscribers on it.
+ * An old socket file at the same path is replaced.
+ * Param path: file path of the socket.
+ * Param eventLoop: pointer to the main loop descriptors.
+ * Param telemetry: pointer to the publisher. Receives the socket.
+ * Return true if the socket is listening and registered.
+ */
+bool setupTelemetry(const char* path, const struct EventLoop* eventLoop, struct Telemetry* telemetry)
+{
+	bool success;
+	struct sockaddr_un addr;
+	struct epoll_event event;
+	struct sigaction action;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if((success = strlen(path) < sizeof(addr.sun_path)))
+	{
+		strcpy(addr.sun_path, path);
+		unlink(path);
+		// a subscriber that hangs up must not kill the stopwatch. writev reports EPIPE instead
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = SIG_IGN;
+		sigaction(SIGPIPE, &action, NULL);
+		telemetry->listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		event.events = EPOLLIN;
+		event.data.u32 = TELEMETRY_EVENT_ID;
+		if(!(success = telemetry->listenFd >= 0 
+			&& !bind(telemetry->listenFd, (struct sockaddr*)&addr, sizeof(addr))
+			&& !listen(telemetry->listenFd, MAX_TELEMETRY_SUBSCRIBERS)
+			&& !epoll_ctl(eventLoop->epollFd, EPOLL_CTL_ADD, telemetry->listenFd, &event)))
+		{
+			printf("Error creating telemetry socket\n");
+		}
+	}
+	else
+	{
+		printf("Telemetry socket path too long\n");
+	}
+	return success;
+}
+
+/**
+ * Disconnect every subscriber, close the telemetry socket and remove its file.
+ * Param path: file path of the socket. NULL if there is no socket.
+ * Param telemetry: pointer to the publisher.
+ */
+void closeTelemetry(const char* path, struct Telemetry* telemetry)
+{
+	for(int i = 0; i < telemetry->numSubscribers; ++i)
+	{
+		close(telemetry->subscriberFds[i]);
+	}
+	telemetry->numSubscribers = 0;
+	if(path && telemetry->listenFd >= 0)
+	{
+		close(telemetry->listenFd);
+		unlink(path);
+	}
+	if(telemetry->shedRecords > 0)
+	{
+		printf("Telemetry subscribers missed %llu records\n", (unsigned long long)telemetry->shedRecords);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// SPLIT FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Get the histogram bucket of a lap. Laps below LAP_SUB_BUCKETS ns have a bucket each. 
+ * Above that, every power of 2 is split into LAP_SUB_BUCKETS buckets of equal width.
+ * Param lapNs: the lap. Negative laps count as 0.
+ * Return the bucket index.
+ */
+static inline int getLapBucket(int64_t lapNs)
+{
+	int bucket = lapNs > 0 ? lapNs : 0;
+	int exponent;
+	if(lapNs >= LAP_SUB_BUCKETS)
+	{
+		exponent = 63 - __builtin_clzll((uint64_t)lapNs);
+		bucket = (exponent - LAP_SUB_BUCKET_BITS + 1) * LAP_SUB_BUCKETS 
+			+ ((lapNs >> (exponent - LAP_SUB_BUCKET_BITS)) & (LAP_SUB_BUCKETS - 1));
+	}
+	return bucket;
+}
+
+/**
+ * Add a lap to the statistics in constant time.
+ * Param stats: pointer to the lap statistics.
+ * Param lapNs: the lap.
+ */
+void updateLapStats(struct LapStats* stats, int64_t lapNs)
+{
+	double delta = lapNs - stats->meanNs;
+	if(stats->count == 0 || lapNs < stats->minNs)
+	{
+		stats->minNs = lapNs;
+	}
+	if(stats->count == 0 || lapNs > stats->maxNs)
+	{
+		stats->maxNs = lapNs;
+	}
+	++stats->count;
+	stats->meanNs += delta / stats->count;
+	stats->sumSquaresNs += delta * (lapNs - stats->meanNs);
+	++stats->buckets[getLapBucket(lapNs)];
+}
+
+/**
+ * Estimate a quantile of the laps from the histogram.
+ * Param stats: pointer to the lap statistics.
+ * Param permille: the quantile in thousandths, e.g. 990 for p99.
+ * Return the middle of the bucket holding the quantile, kept within the smallest and largest lap.
+ */
+int64_t getLapQuantileNs(const struct LapStats* stats, int permille)
+{
+	// nearest rank. the first lap has rank 1
+	uint64_t rank = (stats->count * permille + 999) / 1000;
+	uint64_t seen = 0;
+	int64_t quantileNs = 0;
+	int bucket = 0;
+	int exponent;
+	if(stats->count > 0)
+	{
+		rank = rank > 0 ? rank : 1;
+		while((seen += stats->buckets[bucket]) < rank)
+		{
+			++bucket;
+		}
+		quantileNs = bucket;
+		if(bucket >= LAP_SUB_BUCKETS)
+		{
+			exponent = bucket / LAP_SUB_BUCKETS + LAP_SUB_BUCKET_BITS - 1;
+			quantileNs = ((int64_t)(LAP_SUB_BUCKETS + bucket % LAP_SUB_BUCKETS) << (exponent - LAP_SUB_BUCKET_BITS))
+				+ ((int64_t)1 << (exponent - LAP_SUB_BUCKET_BITS)) / 2;
+		}
+		quantileNs = quantileNs < stats->minNs ? stats->minNs : quantileNs > stats->maxNs ? stats->maxNs : quantileNs;
+	}
+	return quantileNs;
+}
+
+/**
+ * Calculate the population standard deviation of the laps without the math library.
+ * Param stats: pointer to the lap statistics.
+ * Return the standard deviation in nanoseconds.
+ */
+int64_t getLapStdDevNs(const struct LapStats* stats)
+{
+	double variance = stats->count > 0 ? stats->sumSquaresNs / stats->count : 0;
+	double root = variance > 1 ? variance : 1;
+	double prevRoot = 0;
+	// Newton's method. only runs when the statistic is shown
+	for(int i = 0; i < 200 && root != prevRoot; ++i)
+	{
+		prevRoot = root;
+		root = (root + variance / root) / 2;
+	}
+	return variance > 0 ? (int64_t)root : 0;
+}
+
+/**
+ * Get the value of a lap statistic.
+ * Param stats: pointer to the lap statistics.
+ * Param stat: the statistic.
+ * Return the statistic in nanoseconds. 0 without laps.
+ */
+int64_t getLapStatNs(const struct LapStats* stats, enum LapStat stat)
+{
+	int64_t ns = 0;
+	if(stats->count > 0)
+	{
+		switch(stat)
+		{
+			case LAP_STAT_MIN:
+				ns = stats->minNs;
+				break;
+			case LAP_STAT_MAX:
+				ns = stats->maxNs;
+				break;
+			case LAP_STAT_MEAN:
+				ns = (int64_t)stats->meanNs;
+				break;
+			case LAP_STAT_STDDEV:
+				ns = getLapStdDevNs(stats);
+				break;
+			case LAP_STAT_P50:
+				ns = getLapQuantileNs(stats, 500);
+				break;
+			case LAP_STAT_P90:
+				ns = getLapQuantileNs(stats, 900);
+				break;
+			case LAP_STAT_P99:
+				ns = getLapQuantileNs(stats, 990);
+				break;
+			default:
+				break;
+		}
+	}
+	return ns;
+}
+
+/**
+ * Forget every split and lap.
+ * Param history: pointer to the split history.
+ */
+void clearSplits(struct SplitHistory* history)
+{
+	history->total = 0;
+	history->viewIndex = 0;
+	history->shownStat = LAP_STAT_NONE;
+	memset(&history->lapStats, 0, sizeof(history->lapStats));
+}
+
+/**
+ * Get the number of the oldest split still inside the history.
+ * Param history: pointer to the split history.
+ * Return the number of the oldest stored split.
+ */
+uint32_t getOldestSplit(const struct SplitHistory* history)
+{
+	return history->total > MAX_SPLITS ? history->total - MAX_SPLITS : 0;
+}
+
+/**
+ * Record a split and its lap in constant time and show it. The oldest split is overwritten when full.
+ * A lap statistic that is shown stays shown.
+ * Param history: pointer to the split history.
+ * Param splitNs: timer value of the split.
+ */
+void recordSplit(struct SplitHistory* history, int64_t splitNs)
+{
+	int slot = history->total % MAX_SPLITS;
+	int64_t prevSplitNs = history->total > 0 
+		? history->splitNs[(history->total - 1) % MAX_SPLITS] : 0;
+	history->splitNs[slot] = splitNs;
+	history->lapNs[slot] = splitNs - prevSplitNs;
+	updateLapStats(&history->lapStats, history->lapNs[slot]);
+	history->viewIndex = history->total++;
+}
+
+/**
+ * Put back a split whose predecessor was lost, e.g. by a journal compaction.
+ * Its lap is unknown, so it does not count towards the lap statistics.
+ * Param history: pointer to the split history.
+ * Param number: 1-based number of the split. Later than every split in the history.
+ * Param splitNs: timer value of the split.
+ */
+void restoreSplit(struct SplitHistory* history, uint32_t number, int64_t splitNs)
+{
+	int slot = (number - 1) % MAX_SPLITS;
+	history->splitNs[slot] = splitNs;
+	history->lapNs[slot] = 0;
+	history->total = number;
+	history->viewIndex = number - 1;
+}
+
+/**
+ * Move the split line through the history. The lap statistics follow the newest split.
+ * Param history: pointer to the split history.
+ * Param step: -1 for the previous split or statistic, 1 for the next split or statistic.
+ * Return true if the split line changed.
+ */
+bool browseSplits(struct SplitHistory* history, int step)
+{
+	bool isMoved = false;
+	if(step < 0 && history->shownStat != LAP_STAT_NONE)
+	{
+		// the first statistic goes back to the newest split
+		--history->shownStat;
+		isMoved = true;
+	}
+	else if(step < 0 && history->viewIndex > getOldestSplit(history))
+	{
+		--history->viewIndex;
+		isMoved = true;
+	}
+	else if(step > 0 && history->shownStat != LAP_STAT_NONE)
+	{
+		if((isMoved = history->shownStat + 1 < LAP_STAT_COUNT))
+		{
+			++history->shownStat;
+		}
+	}
+	else if(step > 0 && history->viewIndex + 1 < history->total)
+	{
+		++history->viewIndex;
+		isMoved = true;
+	}
+	else if(step > 0 && history->lapStats.count > 0)
+	{
+		history->shownStat = LAP_STAT_MIN;
+		isMoved = true;
+	}
+	return isMoved;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// JOURNAL FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Calculate the CRC-32 of a block of memory.
+ * Param data: the memory.
+ * Param size: number of bytes.
+ * Return the checksum.
+ */
+uint32_t crc32(const void* data, size_t size)
+{
+	static uint32_t table[256];
+	static bool isBuilt = false;
+	const uint8_t* bytes = data;
+	uint32_t crc = 0xFFFFFFFF;
+	uint32_t entry;
+	if(!isBuilt)
+	{
+		for(uint32_t i = 0; i < 256; ++i)
+		{
+			entry = i;
+			for(int bit = 0; bit < 8; ++bit)
+			{
+				entry = entry & 1 ? (entry >> 1) ^ 0xEDB88320 : entry >> 1;
+			}
+			table[i] = entry;
+		}
+		isBuilt = true;
+	}
+	for(size_t i = 0; i < size; ++i)
+	{
+		crc = (crc >> 8) ^ table[(crc ^ bytes[i]) & 0xFF];
+	}
+	return ~crc;
+}
+
+/**
+ * Calculate the checksum a journal record must carry.
+ * Param record: pointer to the record.
+ * Return the checksum of every field after the checksum.
+ */
+static inline uint32_t getJournalChecksum(const struct JournalRecord* record)
+{
+	return crc32((const char*)record + sizeof(record->checksum), sizeof(*record) - sizeof(record->checksum));
+}
+
+/**
+ * Check whether a journal header describes the current layout.
+ * Param header: pointer to the header.
+ * Return true if the records behind the header can be read.
+ */
+bool isJournalHeaderValid(const struct JournalHeader* header)
+{
+	return header->magic == JOURNAL_MAGIC && header->version == JOURNAL_VERSION 
+		&& header->recordSize == sizeof(struct JournalRecord) && header->capacity == JOURNAL_CAPACITY;
+}
+
+/**
+ * Start without a journal.
+ * Param journal: pointer to the journal.
+ */
+void initJournal(struct Journal* journal)
+{
+	memset(journal, 0, sizeof(*journal));
+	journal->eventFd = -1;
+}
+
+/**
+ * Open a journal file and map it. A missing or empty file is started as a new journal.
+ * Any other file that is not a journal of this layout is left alone, in case the path is mistyped.
+ * A new epoch begins and is written out before anything is appended.
+ * Param path: file path of the journal.
+ * Param journal: pointer to the journal. Receives the mapping.
+ * Return true if the journal is mapped.
+ */
+bool openJournal(const char* path, struct Journal* journal)
+{
+	bool success = false;
+	struct JournalHeader header;
+	struct stat st;
+	void* mem = MAP_FAILED;
+	bool isUnknown = false;
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if(fd >= 0 && !fstat(fd, &st))
+	{
+		isUnknown = st.st_size > 0 && (pread(fd, &header, sizeof(header), 0) != sizeof(header) 
+			|| !isJournalHeaderValid(&header));
+		// reserve the blocks up front, so that appends never wait for the file system to allocate them
+		if((success = !isUnknown && !posix_fallocate(fd, 0, JOURNAL_SIZE)))
+		{
+			mem = mmap(0, JOURNAL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			success = mem != MAP_FAILED;
+		}
+	}
+	if(success)
+	{
+		journal->path = path;
+		journal->header = mem;
+		journal->records = (struct JournalRecord*)(journal->header + 1);
+		if(!isJournalHeaderValid(journal->header))
+		{
+			journal->header->magic = JOURNAL_MAGIC;
+			journal->header->version = JOURNAL_VERSION;
+			journal->header->recordSize = sizeof(struct JournalRecord);
+			journal->header->capacity = JOURNAL_CAPACITY;
+		}
+		++journal->header->epoch;
+		msync(journal->header, sizeof(struct JournalHeader), MS_SYNC);
+	}
+	else if(isUnknown)
+	{
+		printf("Not a journal of this version. Remove the file to start a new one\n");
+	}
+	else
+	{
+		printf("Error opening journal\n");
+	}
+	if(fd >= 0)
+	{
+		close(fd);
+	}
+	return success;
+}
+
+/**
+ * Append a timer event to the journal in memory. Never waits for the file.
+ * Param journal: pointer to the journal. Nothing happens without a journal.
+ * Param type: the enum TelemetryType of the event.
+ * Param ts: the CLOCK_MONOTONIC moment of the event.
+ * Param elapsedNs: the timer value at the event.
+ * Param splitCount: the number of splits recorded since the last reset.
+ */
+void appendJournal(
+	struct Journal* journal, 
+	enum TelemetryType type, 
+	const struct timespec* ts, 
+	int64_t elapsedNs, 
+	uint32_t splitCount)
+{
+	struct JournalRecord* record;
+	struct timespec monoTs;
+	struct timespec realTs;
+	if(journal->records && journal->numRecords < JOURNAL_CAPACITY)
+	{
+		// convert the event time with the current offset between the two clocks
+		clock_gettime(CLOCK_MONOTONIC, &monoTs);
+		clock_gettime(CLOCK_REALTIME, &realTs);
+		record = &journal->records[journal->numRecords];
+		memset(record, 0, sizeof(*record));
+		record->epoch = journal->header->epoch;
+		record->splitCount = splitCount;
+		record->type = type;
+		record->realNs = timespecToNs(ts) + timespecToNs(&realTs) - timespecToNs(&monoTs);
+		record->elapsedNs = elapsedNs;
+		record->checksum = getJournalChecksum(record);
+		// the sync thread may only see the record once it is complete
+		__atomic_store_n(&journal->numRecords, journal->numRecords + 1, __ATOMIC_RELEASE);
+	}
+	else if(journal->records)
+	{
+		++journal->droppedRecords;
+	}
+}
+
+/**
+ * Rebuild the session from the journal. Replay stops at the first record that is torn,
+ * zeroed, or from an older epoch than the record before it. Later appends overwrite it.
+ * A session that was running continues, and the time it was not watched counts as well.
+ * Param journal: pointer to the opened journal.
+ * Param timer: pointer to the timer that receives the restored state.
+ * Param history: pointer to the split history that receives the restored splits.
+ */
+void replayJournal(struct Journal* journal, struct Timer* timer, struct SplitHistory* history)
+{
+	const struct JournalRecord* record;
+	struct timespec realTs;
+	int64_t startRealNs = 0;
+	int64_t sinceStartNs;
+	uint32_t epoch = 0;
+	uint32_t i;
+	timer->state = PAUSED;
+	timer->accumulatedNs = 0;
+	clearSplits(history);
+	for(i = 0; i < JOURNAL_CAPACITY; ++i)
+	{
+		record = &journal->records[i];
+		if(record->checksum != getJournalChecksum(record) || record->epoch < epoch)
+		{
+			break;
+		}
+		epoch = record->epoch;
+		switch(record->type)
+		{
+			case TELEMETRY_START:
+				timer->state = RUNNING;
+				timer->accumulatedNs = record->elapsedNs;
+				startRealNs = record->realNs;
+				break;
+			case TELEMETRY_STOP:
+				timer->state = PAUSED;
+				timer->accumulatedNs = record->elapsedNs;
+				break;
+			case TELEMETRY_SPLIT:
+				if(record->splitCount == history->total + 1)
+				{
+					recordSplit(history, record->elapsedNs);
+				}
+				else if(record->splitCount > history->total)
+				{
+					// split numbers skip ahead after a compaction
+					restoreSplit(history, record->splitCount, record->elapsedNs);
+				}
+				break;
+			case TELEMETRY_RESET:
+				timer->accumulatedNs = 0;
+				clearSplits(history);
+				break;
+			default:
+				break;
+		}
+	}
+	journal->numRecords = i;
+	journal->requestedRecords = i;
+	journal->syncedRecords = i;
+	if(timer->state == RUNNING)
+	{
+		// only the real time clock spans a reboot. bank the run so far and start a new run now
+		clock_gettime(CLOCK_REALTIME, &realTs);
+		sinceStartNs = timespecToNs(&realTs) - startRealNs;
+		timer->accumulatedNs += sinceStartNs > 0 ? sinceStartNs : 0;
+		clock_gettime(CLOCK_MONOTONIC, &timer->startTs);
+	}
+}
+
+/**
+ * Get the path of the file a journal is compacted into.
+ * Param journal: pointer to the journal.
+ * Param tmpPath: buffer of PATH_MAX characters that receives the path.
+ * Return true if the path fits.
+ */
+bool getJournalTmpPath(const struct Journal* journal, char* tmpPath)
+{
+	return snprintf(tmpPath, PATH_MAX, "%s.tmp", journal->path) < PATH_MAX;
+}
+
+/**
+ * Write the records that restore the current session into a new journal next to the old one.
+ * These are the last start, stop or reset, followed by the splits since the last reset 
+ * that the split history keeps. Runs on the sync thread. The timing thread keeps appending 
+ * to the old journal meanwhile, and swaps the new one in once it is ready.
+ * Param journal: pointer to the journal.
+ */
+void prepareCompaction(struct Journal* journal)
+{
+	char tmpPath[PATH_MAX];
+	struct Journal compacted;
+	uint32_t numRecords = __atomic_load_n(&journal->numRecords, __ATOMIC_ACQUIRE);
+	uint32_t timerIndex = numRecords;
+	uint32_t firstSplit = 0;
+	uint32_t numSplits = 0;
+	uint32_t numSkipped;
+	initJournal(&compacted);
+	for(uint32_t i = 0; i < numRecords; ++i)
+	{
+		if(journal->records[i].type == TELEMETRY_SPLIT)
+		{
+			++numSplits;
+		}
+		else
+		{
+			timerIndex = i;
+		}
+		if(journal->records[i].type == TELEMETRY_RESET)
+		{
+			firstSplit = i + 1;
+			numSplits = 0;
+		}
+	}
+	if(getJournalTmpPath(journal, tmpPath))
+	{
+		unlink(tmpPath);
+		if(openJournal(tmpPath, &compacted))
+		{
+			compacted.header->epoch = journal->header->epoch;
+			if(timerIndex < numRecords)
+			{
+				compacted.records[compacted.numRecords++] = journal->records[timerIndex];
+			}
+			// the split history only keeps the newest MAX_SPLITS splits
+			numSkipped = numSplits > MAX_SPLITS ? numSplits - MAX_SPLITS : 0;
+			for(uint32_t i = firstSplit; i < numRecords; ++i)
+			{
+				if(journal->records[i].type == TELEMETRY_SPLIT && numSkipped > 0)
+				{
+					--numSkipped;
+				}
+				else if(journal->records[i].type == TELEMETRY_SPLIT)
+				{
+					compacted.records[compacted.numRecords++] = journal->records[i];
+				}
+			}
+			for(uint32_t i = 0; i < compacted.numRecords; ++i)
+			{
+				// records of an older epoch than the ones before them would end the replay
+				compacted.records[i].epoch = compacted.header->epoch;
+				compacted.records[i].checksum = getJournalChecksum(&compacted.records[i]);
+			}
+			msync(compacted.header, JOURNAL_SIZE, MS_SYNC);
+			journal->spareRecords = compacted.numRecords;
+			journal->compactedRecords = numRecords;
+			__atomic_store_n(&journal->spareHeader, compacted.header, __ATOMIC_RELEASE);
+		}
+	}
+}
+
+/**
+ * Switch the timing thread over to the compacted journal. The records appended since it was
+ * prepared are copied behind its records. Only memory is touched.
+ * Param journal: pointer to the journal. mapLock must be held.
+ * Param spare: the compacted journal.
+ */
+void swapJournal(struct Journal* journal, struct JournalHeader* spare)
+{
+	struct JournalRecord* records = (struct JournalRecord*)(spare + 1);
+	uint32_t numTail = journal->numRecords - journal->compactedRecords;
+	memcpy(&records[journal->spareRecords], &journal->records[journal->compactedRecords], 
+		numTail * sizeof(struct JournalRecord));
+	journal->retiredHeader = journal->header;
+	journal->header = spare;
+	journal->records = records;
+	journal->syncedRecords = journal->spareRecords;
+	journal->requestedRecords = journal->spareRecords;
+	journal->numRecords = journal->spareRecords + numTail;
+	journal->spareHeader = NULL;
+}
+
+/**
+ * Sync thread body. Sleeps until records are appended, then writes them out to the file.
+ * A nearly full journal is compacted here as well, so the timing thread never waits for the file.
+ * Param arg: pointer to the journal.
+ * Return NULL.
+ */
+void* syncJournalLoop(void* arg)
+{
+	struct Journal* journal = arg;
+	const uintptr_t PAGE_MASK = ~((uintptr_t)sysconf(_SC_PAGESIZE) - 1);
+	char tmpPath[PATH_MAX];
+	uint64_t requests;
+	uint32_t numRecords;
+	uintptr_t start;
+	uintptr_t end;
+	bool isQuit = false;
+	while(!isQuit)
+	{
+		// every request since the last wake up is served by a single msync
+		if(read(journal->eventFd, &requests, sizeof(requests)) > 0)
+		{
+			isQuit = __atomic_load_n(&journal->isQuit, __ATOMIC_ACQUIRE);
+			pthread_mutex_lock(&journal->mapLock);
+			numRecords = __atomic_load_n(&journal->numRecords, __ATOMIC_ACQUIRE);
+			if(numRecords > journal->syncedRecords)
+			{
+				// msync needs a page aligned start
+				start = (uintptr_t)&journal->records[journal->syncedRecords] & PAGE_MASK;
+				end = (uintptr_t)&journal->records[numRecords];
+				msync((void*)start, end - start, MS_SYNC);
+				journal->syncedRecords = numRecords;
+			}
+			if(journal->retiredHeader)
+			{
+				// the compacted journal and every record behind it are on the file now. 
+				// put it in place of the old one, so that a crash always leaves a whole session
+				if(!getJournalTmpPath(journal, tmpPath) || rename(tmpPath, journal->path))
+				{
+					printf("Error replacing the journal\n");
+				}
+				munmap(journal->retiredHeader, JOURNAL_SIZE);
+				journal->retiredHeader = NULL;
+			}
+			pthread_mutex_unlock(&journal->mapLock);
+			if(!isQuit && numRecords > JOURNAL_CAPACITY - JOURNAL_HEADROOM 
+				&& !__atomic_load_n(&journal->spareHeader, __ATOMIC_ACQUIRE))
+			{
+				prepareCompaction(journal);
+			}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Start the sync thread of an opened journal.
+ * Param journal: pointer to the journal.
+ * Return true if the thread started.
+ */
+bool startJournalSync(struct Journal* journal)
+{
+	bool success;
+	journal->eventFd = eventfd(0, EFD_CLOEXEC);
+	if((success = journal->eventFd >= 0 && !pthread_mutex_init(&journal->mapLock, NULL)))
+	{
+		success = startThread(&journal->syncThread, syncJournalLoop, journal);
+	}
+	if(!success)
+	{
+		printf("Error starting the journal thread\n");
+	}
+	return success;
+}
+
+/**
+ * Hand the records appended since the last call to the sync thread, and switch over to 
+ * a compacted journal once the sync thread has prepared one. Never waits for the file.
+ * Param journal: pointer to the journal. Nothing happens without a journal.
+ */
+void syncJournal(struct Journal* journal)
+{
+	const uint64_t ONE = 1;
+	struct JournalHeader* spare;
+	bool isWakeup;
+	if(journal->records)
+	{
+		isWakeup = journal->numRecords != journal->requestedRecords;
+		spare = __atomic_load_n(&journal->spareHeader, __ATOMIC_ACQUIRE);
+		// the sync thread may be writing out the old mapping. 
+		// rather than wait for it, try again after the next batch. the headroom leaves time
+		if(spare && !pthread_mutex_trylock(&journal->mapLock))
+		{
+			swapJournal(journal, spare);
+			pthread_mutex_unlock(&journal->mapLock);
+			isWakeup = true;
+		}
+		if(isWakeup)
+		{
+			journal->requestedRecords = journal->numRecords;
+			// the counter cannot realistically overflow, so this write never blocks
+			if(write(journal->eventFd, &ONE, sizeof(ONE)) < 0)
+			{
+				printf("Error waking up the journal thread\n");
+			}
+		}
+	}
+}
+
+/**
+ * Stop the sync thread, write out the whole journal and unmap it. The file stays for the next run.
+ * Param journal: pointer to the journal. Nothing happens without a journal.
+ */
+void closeJournal(struct Journal* journal)
+{
+	const uint64_t ONE = 1;
+	char tmpPath[PATH_MAX];
+	if(journal->records)
+	{
+		if(journal->eventFd >= 0)
+		{
+			__atomic_store_n(&journal->isQuit, true, __ATOMIC_RELEASE);
+			if(write(journal->eventFd, &ONE, sizeof(ONE)) > 0)
+			{
+				pthread_join(journal->syncThread, NULL);
+			}
+			close(journal->eventFd);
+		}
+		if(journal->spareHeader && getJournalTmpPath(journal, tmpPath))
+		{
+			// prepared too late to be swapped in
+			munmap(journal->spareHeader, JOURNAL_SIZE);
+			unlink(tmpPath);
+		}
+		msync(journal->header, JOURNAL_SIZE, MS_SYNC);
+		munmap(journal->header, JOURNAL_SIZE);
+		if(journal->droppedRecords > 0)
+		{
+			printf("Journal full. Dropped %llu records\n", (unsigned long long)journal->droppedRecords);
+		}
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// DRAWING FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Write a run of pixels that are smaller than a byte. Pixels are packed most significant bit first.
+ * Only the partially covered bytes at either end are read, the rest are filled whole.
+ * Param rowDest: location of the first byte of the row.
+ * Param col: column of the first pixel of the run.
+ * Param count: number of pixels in the run.
+ * Param isFG: if true, foreground pixels.
+ * Param bitsPP: bits per pixel. Must be a compile time constant of 1, 2 or 4.
+ */
+static inline void blitSubByteSpan(
+	char* rowDest, 
+	unsigned col, 
+	unsigned count, 
+	bool isFG, 
+	const unsigned bitsPP)
+{
+	unsigned bitStart = col * bitsPP;
+	// bit after the last bit of the run
+	unsigned bitEnd = (col + count) * bitsPP;
+	unsigned byteStart = bitStart / 8;
+	unsigned byteEnd = (bitEnd - 1) / 8;
+	// foreground pixels are black
+	unsigned char color = isFG ? 0x00 : 0xFF;
+	unsigned char headMask = 0xFF >> (bitStart % 8);
+	unsigned char tailMask = 0xFF << ((8 - bitEnd % 8) % 8);
+	unsigned char* dest = (unsigned char*)rowDest;
+	if(byteStart == byteEnd)
+	{
+		headMask &= tailMask;
+		dest[byteStart] = (dest[byteStart] & ~headMask) | (color & headMask);
+	}
+	else
+	{
+		dest[byteStart] = (dest[byteStart] & ~headMask) | (color & headMask);
+		memset(&dest[byteStart + 1], color, byteEnd - byteStart - 1);
+		dest[byteEnd] = (dest[byteEnd] & ~tailMask) | (color & tailMask);
+	}
+}
+
+/**
+ * Write a run of pixels that occupy whole bytes. Foreground pixels are all zero bits.
+ * Param rowDest: location of the first byte of the row.
+ * Param col: column of the first pixel of the run.
+ * Param count: number of pixels in the run.
+ * Param isFG: if true, foreground pixels.
+ * Param bytesPP: bytes per pixel. Must be a compile time constant.
+ */
+static inline void blitByteSpan(
+	char* rowDest, 
+	unsigned col, 
+	unsigned count, 
+	bool isFG, 
+	const unsigned bytesPP)
+{
+	memset(&rowDest[col * bytesPP], isFG ? 0x00 : 0xFF, count * bytesPP);
+}
+
+void blitSpan1(char* rowDest, unsigned col, unsigned count, bool isFG)
+{
+	blitSubByteSpan(rowDest, col, count, isFG, 1);
+}
+
+void blitSpan2(char* rowDest, unsigned col, unsigned count, bool isFG)
+{
+	blitSubByteSpan(rowDest, col, count, isFG, 2);
+}
+
+void blitSpan4(char* rowDest, unsigned col, unsigned count, bool isFG)
+{
+	blitSubByteSpan(rowDest, col, count, isFG, 4);
+}
+
+void blitSpan8(char* rowDest, unsigned col, unsigned count, bool isFG)
+{
+	blitByteSpan(rowDest, col, count, isFG, 1);
+}
+
+void blitSpan16(char* rowDest, unsigned col, unsigned count, bool isFG)
+{
+	blitByteSpan(rowDest, col, count, isFG, 2);
+}
+
+void blitSpan24(char* rowDest, unsigned col, unsigned count, bool isFG)
+{
+	blitByteSpan(rowDest, col, count, isFG, 3);
+}
+
+void blitSpan32(char* rowDest, unsigned col, unsigned count, bool isFG)
+{
+	blitByteSpan(rowDest, col, count, isFG, 4);
+}
+
+/**
+ * Choose the span blitter that matches the bits per pixel of a frame buffer.
+ * Param fbInfo: pointer to frame buffer info. Receives the blitter.
+ * Return true if the bits per pixel are supported.
+ */
+bool selectSpanBlitter(struct FrameBufferInfo* fbInfo)
+{
+	bool success = true;
+	switch(fbInfo->bitsPP)
+	{
+		case 1:
+			fbInfo->blitSpan = blitSpan1;
+			break;
+		case 2:
+			fbInfo->blitSpan = blitSpan2;
+			break;
+		case 4:
+			fbInfo->blitSpan = blitSpan4;
+			break;
+		case 8:
+			fbInfo->blitSpan = blitSpan8;
+			break;
+		case 16:
+			fbInfo->blitSpan = blitSpan16;
+			break;
+		case 24:
+			fbInfo->blitSpan = blitSpan24;
+			break;
+		case 32:
+			fbInfo->blitSpan = blitSpan32;
+			break;
+		default:
+			fbInfo->blitSpan = NULL;
+			success = false;
+			printf("Unsupported bits per pixel: %u\n", fbInfo->bitsPP);
+			break;
+	}
+	return success;
+}
+
+/**
+ * Get the bits of a bitplane word that lie inside a range of columns.
+ * Param wordStartCol: column of the first pixel in the word.
+ * Param left: first column of the range.
+ * Param right: column after the last column of the range.
+ * Return the mask of the word bits inside the range.
+ */
+PixelWord getColumnMask(unsigned wordStartCol, unsigned left, unsigned right)
+{
+	PixelWord mask = ~(PixelWord)0;
+	if(left > wordStartCol)
+	{
+		mask <<= left - wordStartCol;
+	}
+	if(right < wordStartCol + PIXEL_WORD_BITS)
+	{
+		mask &= ((PixelWord)1 << (right - wordStartCol)) - 1;
+	}
+	return mask;
+}
+
+/**
+ * Mark a rectangle of the pixel matrix as needing to be written.
+ * The rectangle is merged with every tracked rectangle that it overlaps or touches.
+ * Param pixelMatrix: pointer to the pixel matrix.
+ * Param rect: the rectangle that contains updated pixels.
+ */
+void markDirtyRect(struct PixelMatrix* pixelMatrix, struct DirtyRect rect)
+{
+	struct DirtyRect* other;
+	int i = 0;
+	while(i < pixelMatrix->numDirtyRects)
+	{
+		other = &pixelMatrix->dirtyRects[i];
+		if(rect.left <= other->right && other->left <= rect.right
+			&& rect.top <= other->bottom && other->top <= rect.bottom)
+		{
+			// grow the rectangle to cover both and remove the other one.
+			// the grown rectangle may now touch rectangles that were already checked
+			rect.top = rect.top < other->top ? rect.top : other->top;
+			rect.left = rect.left < other->left ? rect.left : other->left;
+			rect.bottom = rect.bottom > other->bottom ? rect.bottom : other->bottom;
+			rect.right = rect.right > other->right ? rect.right : other->right;
+			*other = pixelMatrix->dirtyRects[--pixelMatrix->numDirtyRects];
+			i = 0;
+		}
+		else
+		{
+			++i;
+		}
+	}
+	if(pixelMatrix->numDirtyRects == MAX_DIRTY_RECTS)
+	{
+		// out of slots. collapse everything into a single bounding rectangle
+		for(i = 0; i < pixelMatrix->numDirtyRects; ++i)
+		{
+			other = &pixelMatrix->dirtyRects[i];
+			rect.top = rect.top < other->top ? rect.top : other->top;
+			rect.left = rect.left < other->left ? rect.left : other->left;
+			rect.bottom = rect.bottom > other->bottom ? rect.bottom : other->bottom;
+			rect.right = rect.right > other->right ? rect.right : other->right;
+		}
+		pixelMatrix->numDirtyRects = 0;
+	}
+	pixelMatrix->dirtyRects[pixelMatrix->numDirtyRects++] = rect;
+}
+
+/**
+ * Write pixel matrix information into the memory mapped frame buffer.
+ * Only the dirty rectangles are visited, and inside of them only the dirty bitplane is scanned.
+ * Neighbouring dirty pixels of the same color are written together as one span.
+ * Param fbDest: the memory map location of the frame buffer.
+ * Param fbpm: frame buffer info + pixel matrix.
+ */
+void writeToFrameBuffer(char* fbDest, const struct FrameBufferPixelMatrix* fbpm)
+{
+	struct PixelMatrix* pm = fbpm->pixelMatrix;
+	const SpanBlitter blitSpan = fbpm->fbInfo.blitSpan;
+	const struct DirtyRect* rect;
+	char* rowDest;
+	unsigned wordIndex;
+	unsigned wordStartCol;
+	int start;
+	int runLen;
+	PixelWord rectMask;
+	PixelWord dirtyBits;
+	PixelWord fgBits;
+	PixelWord runBits;
+	// the span waiting to be written. it grows while the next run continues it
+	unsigned spanCol = 0;
+	unsigned spanLen = 0;
+	bool spanIsFG = false;
+
+	pm->lastFlush.rects = pm->numDirtyRects;
+	pm->lastFlush.pixelsVisited = 0;
+	pm->lastFlush.pixelsWritten = 0;
+	pm->lastFlush.spansWritten = 0;
+	for(int i = 0; i < pm->numDirtyRects; ++i)
+	{
+		rect = &pm->dirtyRects[i];
+		pm->lastFlush.pixelsVisited += (rect->bottom - rect->top) * (rect->right - rect->left);
+		for(int row = rect->top; row < rect->bottom; ++row)
+		{
+			rowDest = fbDest + fbpm->blitPlan->rowOffsets[row];
+			for(unsigned rowWord = rect->left / PIXEL_WORD_BITS; 
+				rowWord * PIXEL_WORD_BITS < (unsigned)rect->right; ++rowWord)
+			{
+				wordIndex = row * pm->wordsPerRow + rowWord;
+				wordStartCol = rowWord * PIXEL_WORD_BITS;
+				rectMask = getColumnMask(wordStartCol, rect->left, rect->right);
+				dirtyBits = pm->dirtyPlane[wordIndex] & rectMask;
+				// only proceed if the word contains pixels that need to be drawn
+				if(dirtyBits)
+				{
+					// unset the draw flags of the visited pixels
+					pm->dirtyPlane[wordIndex] &= ~rectMask;
+					fgBits = pm->fgPlane[wordIndex];
+					do
+					{
+						// the run starts at the lowest dirty pixel and continues 
+						// while pixels are dirty and have the same color
+						start = __builtin_ctzl(dirtyBits);
+						runBits = (dirtyBits >> start) 
+							& ((fgBits >> start) & 1 ? fgBits >> start : ~(fgBits >> start));
+						runLen = ~runBits ? __builtin_ctzl(~runBits) : (int)PIXEL_WORD_BITS;
+						if(spanLen > 0 && spanCol + spanLen == wordStartCol + start
+							&& spanIsFG == ((fgBits >> start) & 1))
+						{
+							spanLen += runLen;
+						}
+						else
+						{
+							if(spanLen > 0)
+							{
+								blitSpan(rowDest, spanCol, spanLen, spanIsFG);
+								++pm->lastFlush.spansWritten;
+							}
+							spanCol = wordStartCol + start;
+							spanLen = runLen;
+							spanIsFG = (fgBits >> start) & 1;
+						}
+						pm->lastFlush.pixelsWritten += runLen;
+						dirtyBits &= runLen < (int)PIXEL_WORD_BITS 
+							? ~((((PixelWord)1 << runLen) - 1) << start) : 0;
+					} while(dirtyBits);
+				}
+			}
+			// spans never continue into the next row
+			if(spanLen > 0)
+			{
+				blitSpan(rowDest, spanCol, spanLen, spanIsFG);
+				++pm->lastFlush.spansWritten;
+				spanLen = 0;
+			}
+		}
+	}
+	// the quit frame and other empty writes would only dilute the totals
+	if(pm->numDirtyRects > 0)
+	{
+		++pm->totalFlush.flushes;
+		pm->totalFlush.rects += pm->lastFlush.rects;
+		pm->totalFlush.pixelsVisited += pm->lastFlush.pixelsVisited;
+		pm->totalFlush.pixelsWritten += pm->lastFlush.pixelsWritten;
+		pm->totalFlush.spansWritten += pm->lastFlush.spansWritten;
+	}
+	pm->numDirtyRects = 0;
+}
+
+/**
+ * Copy the bytes covered by dirty rectangles from one frame buffer sized region to another.
+ * Rectangles that span whole lines are copied in a single block.
+ * Param dest: the region to copy to.
+ * Param src: the region to copy from.
+ * Param rects: the dirty rectangles.
+ * Param numRects: number of dirty rectangles.
+ * Param fbpm: frame buffer info + pixel matrix.
+ */
+void copyDirtySpans(
+	char* dest, 
+	const char* src, 
+	const struct DirtyRect* rects, 
+	int numRects, 
+	const struct FrameBufferPixelMatrix* fbpm)
+{
+	const uint32_t* rowOffsets = fbpm->blitPlan->rowOffsets;
+	unsigned startByte;
+	unsigned numBytes;
+	uint32_t offset;
+	for(int i = 0; i < numRects; ++i)
+	{
+		startByte = rects[i].left * fbpm->fbInfo.bitsPP / 8;
+		numBytes = (rects[i].right * fbpm->fbInfo.bitsPP + 7) / 8 - startByte;
+		if(numBytes == fbpm->fbInfo.lineLength)
+		{
+			// whole lines are contiguous
+			offset = rowOffsets[rects[i].top];
+			memcpy(dest + offset, src + offset, 
+				(rects[i].bottom - rects[i].top) * fbpm->fbInfo.lineLength);
+		}
+		else
+		{
+			for(int row = rects[i].top; row < rects[i].bottom; ++row)
+			{
+				offset = rowOffsets[row] + startByte;
+				memcpy(dest + offset, src + offset, numBytes);
+			}
+		}
+	}
+}
+
+/**
+ * Write the pending pixel matrix changes to the screen so that the frame appears at once.
+ * When page flipping, the hidden page is written, panned to, and the old front page is 
+ * brought up to date to become the next hidden page. In shadow mode the shadow buffer is
+ * written and only its dirty bytes are copied to the frame buffer.
+ * Param display: pointer to the display.
+ * Param fbpm: frame buffer info + pixel matrix.
+ */
+void presentFrame(struct FrameBufferDisplay* display, const struct FrameBufferPixelMatrix* fbpm)
+{
+	struct DirtyRect rects[MAX_DIRTY_RECTS];
+	int numRects = fbpm->pixelMatrix->numDirtyRects;
+	char* frontDest;
+	// writing empties the dirty rectangles
+	memcpy(rects, fbpm->pixelMatrix->dirtyRects, numRects * sizeof(struct DirtyRect));
+	writeToFrameBuffer(display->drawDest, fbpm);
+	if(numRects > 0 && display->mode == PAGE_FLIP_DISPLAY)
+	{
+		frontDest = display->fbDest + display->frontPage * display->pageSize;
+		display->fbVar.yoffset = (1 - display->frontPage) * fbpm->fbInfo.screenHeight;
+		if(!ioctl(display->fd, FBIOPAN_DISPLAY, &display->fbVar))
+		{
+			// the old front page becomes the hidden page
+			display->frontPage = 1 - display->frontPage;
+			copyDirtySpans(frontDest, display->drawDest, rects, numRects, fbpm);
+			display->drawDest = frontDest;
+		}
+		else
+		{
+			printf("Error panning display. Writing to the frame buffer directly\n");
+			copyDirtySpans(frontDest, display->drawDest, rects, numRects, fbpm);
+			display->drawDest = frontDest;
+			display->mode = DIRECT_DISPLAY;
+		}
+	}
+	else if(display->mode == SHADOW_DISPLAY)
+	{
+		copyDirtySpans(display->fbDest, display->drawDest, rects, numRects, fbpm);
+	}
+}
+
+/**
+ * Update a pixel in the pixel matrix without tracking its dirty rectangle.
+ * Param row: row of the pixel in the matrix.
+ * Param col: column of the pixel in the matrix.
+ * Param isFG: if true, foreground pixel.
+ * Param pixelMatrix: pointer to the pixel matrix.
+ * Return true if the pixel changed color.
+ */
+bool updatePixel(int row, int col, bool isFG, struct PixelMatrix* pixelMatrix)
+{
+	unsigned wordIndex = row * pixelMatrix->wordsPerRow + col / PIXEL_WORD_BITS;
+	PixelWord mask = (PixelWord)1 << (col % PIXEL_WORD_BITS);
+	// check if the pixel's current color differs from its desired color
+	bool isChanged = ((pixelMatrix->fgPlane[wordIndex] & mask) != 0) != isFG;
+	if(isChanged)
+	{
+		pixelMatrix->fgPlane[wordIndex] ^= mask;
+		pixelMatrix->dirtyPlane[wordIndex] |= mask;
+	}
+	return isChanged;
+}
+
+/**
+ * Update a pixel in the pixel matrix.
+ * Param row: row of the pixel in the matrix.
+ * Param col: column of the pixel in the matrix.
+ * Param isFG: if true, foreground pixel.
+ * Param fbpm: frame buffer info + pixel matrix.
+ */
+void setPixel(
+	int row, 
+	int col, 
+	bool isFG, 
+	const struct FrameBufferPixelMatrix* fbpm)
+{
+	struct DirtyRect rect = {row, col, row + 1, col + 1};
+	if(updatePixel(row, col, isFG, fbpm->pixelMatrix))
+	{
+		markDirtyRect(fbpm->pixelMatrix, rect);
+	}
+}
+
+/**
+ * Update a horizontal run of pixels in the pixel matrix with at most two masked word writes.
+ * The run must not start left of the screen.
+ * Param row: row of the run in the matrix.
+ * Param col: column of the leftmost pixel of the run.
+ * Param bits: pixel colors of the run. bit i is the pixel in column (col + i).
+ * Param width: number of pixels in the run. Must be less than 32.
+ * Param fbpm: frame buffer info + pixel matrix.
+ * Return true if any pixel changed color.
+ */
+bool updatePixelRun(
+	unsigned row, 
+	unsigned col, 
+	uint32_t bits, 
+	unsigned width, 
+	const struct FrameBufferPixelMatrix* fbpm)
+{
+	const struct PixelMatrix* pm = fbpm->pixelMatrix;
+	unsigned wordIndex = row * pm->wordsPerRow + col / PIXEL_WORD_BITS;
+	unsigned shift = col % PIXEL_WORD_BITS;
+	PixelWord runMask;
+	PixelWord changed;
+	PixelWord changedHigh = 0;
+
+	// clip the run to the right edge of the screen
+	if(col + width > fbpm->fbInfo.screenWidth)
+	{
+		width = col < fbpm->fbInfo.screenWidth ? fbpm->fbInfo.screenWidth - col : 0;
+	}
+	runMask = ((PixelWord)1 << width) - 1;
+	bits &= runMask;
+	// pixels inside the run whose color differs from the desired color
+	changed = (pm->fgPlane[wordIndex] ^ ((PixelWord)bits << shift)) & (runMask << shift);
+	pm->fgPlane[wordIndex] ^= changed;
+	pm->dirtyPlane[wordIndex] |= changed;
+	if(shift + width > PIXEL_WORD_BITS)
+	{
+		// the run continues into the next word
+		changedHigh = (pm->fgPlane[wordIndex + 1] ^ ((PixelWord)bits >> (PIXEL_WORD_BITS - shift))) 
+			& (runMask >> (PIXEL_WORD_BITS - shift));
+		pm->fgPlane[wordIndex + 1] ^= changedHigh;
+		pm->dirtyPlane[wordIndex + 1] |= changedHigh;
+	}
+	return changed || changedHigh;
+}
+
+/**
+ * Get the glyph rows of every glyph widened to a given scale. 
+ * The rows are computed the first time a scale is requested.
+ * Param scale: the text scale. Must be in [1, MAX_GLYPH_SCALE].
+ * Return pointer to the scaled glyphs.
+ */
+const struct ScaledGlyphs* getScaledGlyphs(int scale)
+{
+	static struct ScaledGlyphs cache[MAX_GLYPH_SCALE + 1];
+	struct ScaledGlyphs* glyphs = &cache[scale];
+	uint32_t scaledRow;
+	if(!glyphs->isBuilt)
+	{
+		for(int glyph = 0; glyph < GLYPH_COUNT; ++glyph)
+		{
+			for(int bitRow = 0; bitRow < BITMAP_HEIGHT; ++bitRow)
+			{
+				scaledRow = 0;
+				for(int bitCol = 0; bitCol < BITMAP_WIDTH; ++bitCol)
+				{
+					// the leftmost column is the most significant bit of a packed row
+					if(GLYPH_BITMAPS[glyph][bitRow] & (1 << (BITMAP_WIDTH - 1 - bitCol)))
+					{
+						scaledRow |= ((1u << scale) - 1) << (bitCol * scale);
+					}
+				}
+				glyphs->rows[glyph][bitRow] = scaledRow;
+			}
+		}
+		glyphs->isBuilt = true;
+	}
+	return glyphs;
+}
+
+/**
+ * Precompute the row offsets of a frame buffer layout and attach the plan to it.
+ * Param plan: pointer to the plan to build.
+ * Param fbpm: frame buffer info + pixel matrix. Receives the plan.
+ * Return true if the plan was built.
+ */
+bool buildBlitPlan(struct BlitPlan* plan, struct FrameBufferPixelMatrix* fbpm)
+{
+	bool success;
+	plan->numCells = 0;
+	plan->rowOffsets = malloc(fbpm->fbInfo.screenHeight * sizeof(uint32_t));
+	if((success = plan->rowOffsets != NULL))
+	{
+		for(unsigned row = 0; row < fbpm->fbInfo.screenHeight; ++row)
+		{
+			plan->rowOffsets[row] = row * fbpm->fbInfo.lineLength;
+		}
+		fbpm->blitPlan = plan;
+	}
+	else
+	{
+		printf("Error allocating blit plan\n");
+	}
+	return success;
+}
+
+/**
+ * Free the tables of a blit plan.
+ * Param plan: pointer to the plan.
+ */
+void freeBlitPlan(struct BlitPlan* plan)
+{
+	free(plan->rowOffsets);
+	plan->rowOffsets = NULL;
+	plan->numCells = 0;
+}
+
+/**
+ * Compile the character cells of a text slot into a blit plan.
+ * Every cell whose top left corner is onscreen is compiled, up to the length of the string buffer.
+ * Param plan: pointer to the blit plan.
+ * Param tFormat: text formatting of the slot. Receives the compiled cells.
+ * Param fbpm: frame buffer info + pixel matrix.
+ * Return true if every onscreen cell fit into the plan.
+ */
+bool registerTextSlot(
+	struct BlitPlan* plan, 
+	struct TextFormat* tFormat, 
+	const struct FrameBufferPixelMatrix* fbpm)
+{
+	const unsigned glyphWidth = BITMAP_WIDTH * tFormat->scale;
+	const unsigned wordsPerRow = fbpm->pixelMatrix->wordsPerRow;
+	struct CellPlan* cell;
+	struct PlannedRow* plannedRow;
+	unsigned xOffset;
+	unsigned currY;
+	unsigned width;
+	PixelWord runMask;
+	bool success = true;
+
+	tFormat->cells = &plan->cells[plan->numCells];
+	tFormat->numCells = 0;
+	for(int i = 0; i < BUF_SIZE - 1 && success; ++i)
+	{
+		xOffset = tFormat->posX + i * tFormat->scale * (BITMAP_WIDTH + BITMAP_SPACE);
+		if(xOffset >= fbpm->fbInfo.screenWidth)
+		{
+			// this cell and every cell after it is offscreen
+			break;
+		}
+		if((success = plan->numCells < MAX_PLANNED_CELLS))
+		{
+			cell = &plan->cells[plan->numCells++];
+			++tFormat->numCells;
+			width = xOffset + glyphWidth > fbpm->fbInfo.screenWidth 
+				? fbpm->fbInfo.screenWidth - xOffset : glyphWidth;
+			runMask = ((PixelWord)1 << width) - 1;
+			cell->glyphs = getScaledGlyphs(tFormat->scale);
+			cell->numRows = 0;
+			cell->rect.top = tFormat->posY;
+			cell->rect.left = xOffset;
+			cell->rect.bottom = tFormat->posY;
+			cell->rect.right = xOffset + width;
+			for(int bitRow = 0; bitRow < BITMAP_HEIGHT; ++bitRow)
+			{
+				for(int subRow = 0; subRow < tFormat->scale; ++subRow)
+				{
+					currY = tFormat->posY + bitRow * tFormat->scale + subRow;
+					if(currY < fbpm->fbInfo.screenHeight)
+					{
+						plannedRow = &cell->rows[cell->numRows++];
+						plannedRow->wordIndex = currY * wordsPerRow + xOffset / PIXEL_WORD_BITS;
+						plannedRow->shift = xOffset % PIXEL_WORD_BITS;
+						plannedRow->bitRow = bitRow;
+						plannedRow->lowMask = runMask << plannedRow->shift;
+						// the part of the row that spills into the next word
+						plannedRow->highMask = plannedRow->shift + width > PIXEL_WORD_BITS
+							? runMask >> (PIXEL_WORD_BITS - plannedRow->shift) : 0;
+						cell->rect.bottom = currY + 1;
+					}
+				}
+			}
+		}
+		else
+		{
+			printf("Blit plan is out of cells\n");
+		}
+	}
+	return success;
+}
+
+/**
+ * Draw a glyph into a compiled character cell by walking the cell's precomputed rows.
+ * Param cell: pointer to the compiled cell.
+ * Param glyph: the glyph to draw.
+ * Param fbpm: frame buffer info + pixel matrix.
+ */
+void drawPlannedGlyph(
+	const struct CellPlan* cell, 
+	enum Glyph glyph, 
+	const struct FrameBufferPixelMatrix* fbpm)
+{
+	struct PixelMatrix* pm = fbpm->pixelMatrix;
+	const uint32_t* glyphRows = cell->glyphs->rows[glyph];
+	const struct PlannedRow* row;
+	PixelWord bits;
+	PixelWord changed;
+	PixelWord isChanged = 0;
+	for(int i = 0; i < cell->numRows; ++i)
+	{
+		row = &cell->rows[i];
+		bits = glyphRows[row->bitRow];
+		changed = (pm->fgPlane[row->wordIndex] ^ (bits << row->shift)) & row->lowMask;
+		pm->fgPlane[row->wordIndex] ^= changed;
+		pm->dirtyPlane[row->wordIndex] |= changed;
+		isChanged |= changed;
+		if(row->highMask)
+		{
+			changed = (pm->fgPlane[row->wordIndex + 1] ^ (bits >> (PIXEL_WORD_BITS - row->shift))) 
+				& row->highMask;
+			pm->fgPlane[row->wordIndex + 1] ^= changed;
+			pm->dirtyPlane[row->wordIndex + 1] |= changed;
+			isChanged |= changed;
+		}
+	}
+	if(isChanged)
+	{
+		markDirtyRect(pm, cell->rect);
+	}
+}
+
+/**
+ * Draw a given glyph somewhere on the pixel matrix.
+ * Param glyph: the glyph to draw.
+ * Param tFormat: position and scale of the glyph.
+ * Param fbpm: frame buffer info + pixel matrix.
+ */
+void drawBitMap(
+	enum Glyph glyph, 
+	const struct TextFormat* tFormat,
+	const struct FrameBufferPixelMatrix* fbpm)
+{
+	const struct ScaledGlyphs* glyphs = getScaledGlyphs(tFormat->scale);
+	const unsigned glyphWidth = BITMAP_WIDTH * tFormat->scale;
+	bool isChanged = false;
+	unsigned currY;
+	struct DirtyRect rect;
+	for(int bitRow = 0; bitRow < BITMAP_HEIGHT; ++bitRow)
+	{
+		// subRow: the row of pixels inside of one bitmap bit
+		for(int subRow = 0; subRow < tFormat->scale; ++subRow)
+		{
+			currY = tFormat->posY + bitRow * tFormat->scale + subRow;
+			if(currY < fbpm->fbInfo.screenHeight)
+			{
+				isChanged |= updatePixelRun(currY, tFormat->posX, 
+					glyphs->rows[glyph][bitRow], glyphWidth, fbpm);
+			}
+		}
+	}
+	if(isChanged)
+	{
+		// a single rectangle covers the onscreen part of the bitmap
+		rect.top = tFormat->posY;
+		rect.left = tFormat->posX;
+		rect.bottom = tFormat->posY + BITMAP_HEIGHT * tFormat->scale;
+		rect.right = tFormat->posX + glyphWidth;
+		if((unsigned)rect.bottom > fbpm->fbInfo.screenHeight)
+		{
+			rect.bottom = fbpm->fbInfo.screenHeight;
+		}
+		if((unsigned)rect.right > fbpm->fbInfo.screenWidth)
+		{
+			rect.right = fbpm->fbInfo.screenWidth;
+		}
+		markDirtyRect(fbpm->pixelMatrix, rect);
+	}
+}
+
+/**
+ * Draw a single character cell of a string.
+ * Param c: the character.
+ * Param i: position of the character in the string.
+ * Param tFormat: text formatting of the string.
+ * Param fbpm: frame buffer info + pixel matrix.
+ * Return false if the cell lies beyond the right edge of the screen.
+ */
+bool drawCharCell(
+	char c, 
+	int i, 
+	const struct TextFormat* tFormat, 
+	const struct FrameBufferPixelMatrix* fbpm)
+{
+	unsigned xOffset;
+	bool inBounds = true;
+	// character text formatting
+	struct TextFormat charFormat;
+	if(i < tFormat->numCells)
+	{
+		// compiled cells skip all position arithmetic
+		drawPlannedGlyph(&tFormat->cells[i], CHAR_GLYPHS[(unsigned char)c], fbpm);
+	}
+	else
+	{
+		xOffset = tFormat->posX + i * tFormat->scale * (BITMAP_WIDTH + BITMAP_SPACE);
+		// top left corner of character bitmap must be onscreen
+		if((inBounds = xOffset < fbpm->fbInfo.screenWidth))
+		{
+			initTextFormat(&charFormat, tFormat->posY, xOffset, tFormat->scale);
+			drawBitMap(CHAR_GLYPHS[(unsigned char)c], &charFormat, fbpm);
+		}
+	}
+	return inBounds;
+}
+
+/**
+ * Draw a string of characters on a given pixel matrix.
+ * Characters that are unchanged since the last string drawn with the same format are skipped.
+ * A change in length redraws every character and blanks the cells left over from the old string.
+ * Param str: the string to draw.
+ * Param tFormat: text formatting of the string. Remembers the drawn string.
+ * Param fbpm: frame buffer info + pixel matrix.
+ */
+void drawString(
+	const char* str, 
+	struct TextFormat* tFormat, 
+	const struct FrameBufferPixelMatrix* fbpm)
+{
+	int len = strlen(str);
+	int numCells = len > tFormat->lastLen ? len : tFormat->lastLen;
+	bool isRelayout = len != tFormat->lastLen;
+	bool inBounds = true;
+	char c;
+
+	// loop through the character cells of both the new and the old string
+	for(int i = 0; i < numCells && inBounds; ++i)
+	{
+		c = i < len ? str[i] : ' ';
+		// characters beyond the remembered string are always drawn
+		if(isRelayout || i >= BUF_SIZE - 1 || c != tFormat->lastStr[i])
+		{
+			inBounds = drawCharCell(c, i, tFormat, fbpm);
+		}
+	}
+	// remember the drawn string
+	strncpy(tFormat->lastStr, str, BUF_SIZE - 1);
+	tFormat->lastStr[BUF_SIZE - 1] = '\0';
+	tFormat->lastLen = len;
+}
+
+/**
+ * Draw only the given character cells of a string, without comparing characters.
+ * Falls back to drawString when the length differs from the last drawn string.
+ * Param str: the string to draw.
+ * Param changed: positions of the characters that changed since the last draw.
+ * Param tFormat: text formatting of the string. Remembers the drawn string.
+ * Param fbpm: frame buffer info + pixel matrix.
+ */
+void drawStringChanges(
+	const char* str, 
+	CharMask changed, 
+	struct TextFormat* tFormat, 
+	const struct FrameBufferPixelMatrix* fbpm)
+{
+	int len = strlen(str);
+	int i;
+	if(len != tFormat->lastLen || len >= BUF_SIZE)
+	{
+		drawString(str, tFormat, fbpm);
+	}
+	else
+	{
+		while(changed)
+		{
+			i = __builtin_ctz(changed);
+			changed &= changed - 1;
+			drawCharCell(str[i], i, tFormat, fbpm);
+			tFormat->lastStr[i] = str[i];
+		}
+	}
+}
+
+/**
+ * Draw a timer value on the title line. Every title draw must go through here so that
+ * the incremental time fields always match the screen.
+ * Param ns: the timer value.
+ * Param titleFormat: text formatting for timer title.
+ * Param fbpm: frame buffer info + pixel matrix.
+ */
+void drawTitle(
+	int64_t ns, 
+	struct TextFormat* titleFormat, 
+	const struct FrameBufferPixelMatrix* fbpm)
+{
+	static struct TimeFields fields;
+	CharMask changed = advanceTimeFields(&fields, ns - fields.ns);
+	drawStringChanges(fields.str, changed, titleFormat, fbpm);
+}
+
+/**
+ * Draw a split prefixed with its 1-based number, or a lap statistic prefixed with its label. 
+ * Without splits a zero time is drawn.
+ * Param splitNumber: 1-based number of the split. 0 if there are no splits.
+ * Param splitNs: the split time, or the value of the lap statistic.
+ * Param lapStat: the lap statistic to draw instead of the split. LAP_STAT_NONE for the split.
+ * Param splitFormat: text formatting for split timestamp.
+ * Param fbpm: frame buffer info + pixel matrix.
+ */
+void drawSplitLine(
+	uint32_t splitNumber, 
+	int64_t splitNs, 
+	enum LapStat lapStat,
+	struct TextFormat* splitFormat, 
+	const struct FrameBufferPixelMatrix* fbpm)
+{
+	// labels in order of enum LapStat. each is padded to the same width
+	static const char* LABELS[LAP_STAT_COUNT] = {
+		"", "MIN ", "MAX ", "AVG ", "SD  ", "P50 ", "P90 ", "P99 "};
+	static char strBuf[BUF_SIZE];
+	int len = 0;
+	if(lapStat != LAP_STAT_NONE)
+	{
+		len = strlen(LABELS[lapStat]);
+		memcpy(strBuf, LABELS[lapStat], len);
+		nsToString(splitNs, strBuf + len, BUF_SIZE - len);
+	}
+	else if(splitNumber > 0)
+	{
+		len = uintToString(splitNumber, strBuf);
+		strBuf[len++] = ' ';
+		nsToString(splitNs, strBuf + len, BUF_SIZE - len);
+	}
+	else
+	{
+		nsToString(0, strBuf, BUF_SIZE);
+	}
+	drawString(strBuf, splitFormat, fbpm);
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// INIT FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Prevent terminal text from appearing onscreen.
+ * return true if graphics mode was successfully enabled.
+ * See https://github.com/ev3dev/ev3dev/issues/1643#issuecomment-2237762929
+ */
+bool enableGraphicsMode()
+{
+	bool success;
+	// Get the file descriptor for the virtual terminal 
+	// (started when using 'brickrun' from SSH, or when running program from the brick)
+    int fd = open("/dev/tty", O_RDWR);
+    if ((success = fd >= 0))
+	{
+    	// Set the virtual terminal to "graphics mode", 
+		// to prevent terminal text from showing up on the screen
+    	success = !ioctl(fd, KDSETMODE, KD_GRAPHICS);
+		close(fd);
+	}
+	else
+	{
+        printf("Error opening tty descriptor\n");
+	}
+	return success;
+}
+
+/**
+ * Memory map the frame buffer file.
+ * Param path: path of the frame buffer device.
+ * Param fbInfo: pointer to frame buffer info.
+ * Param fbDest: pointer to pointer of memory map location.
+ * return true if memory mapping was successful.
+ */
+bool setupMmap(const char* path, const struct FrameBufferInfo* fbInfo, char** fbDest)
+{
+	bool success;
+	int fd = open(path, O_RDWR | O_CLOEXEC);
+	if((success = fd >= 0))
+	{
+		// memory map the frame buffer
+		*fbDest = mmap(0, fbInfo->size, PROT_WRITE, MAP_SHARED, fd, 0);
+		if((success = *fbDest != MAP_FAILED))
+		{
+			// clear frame buffer before use
+			memset(*fbDest, 0xFF, fbInfo->size);
+		}
+		else
+		{
+		    printf("Error creating memory map\n");
+		}
+		close(fd);
+	}
+	else
+	{
+        printf("Error opening framebuffer device\n");
+	}
+	return success;
+}
+
+/**
+ * Set up a frame buffer in memory instead of on a display device.
+ * Param options: pointer to the options holding the geometry and optional backing file.
+ * Param fbInfo: frame buffer info is written into this struct.
+ * Param fbDest: pointer to pointer of memory map location.
+ * return true if the frame buffer was created.
+ */
+bool setupHeadlessFrameBuffer(
+	const struct Options* options, 
+	struct FrameBufferInfo* fbInfo, 
+	char** fbDest)
+{
+	bool success;
+	int fd;
+	fbInfo->screenWidth = options->headlessWidth;
+	fbInfo->screenHeight = options->headlessHeight;
+	fbInfo->bitsPP = options->headlessBitsPP;
+	fbInfo->lineLength = (fbInfo->screenWidth * fbInfo->bitsPP + 7) / 8;
+	fbInfo->size = fbInfo->lineLength * fbInfo->screenHeight;
+	if(options->fbPath)
+	{
+		// file backed. other processes can watch the frame buffer
+		fd = open(options->fbPath, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if((success = fd >= 0 && !ftruncate(fd, fbInfo->size)))
+		{
+			*fbDest = mmap(0, fbInfo->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		}
+		if(fd >= 0)
+		{
+			close(fd);
+		}
+	}
+	else
+	{
+		success = true;
+		*fbDest = mmap(0, fbInfo->size, PROT_READ | PROT_WRITE, 
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	if((success = success && *fbDest != MAP_FAILED))
+	{
+		// clear frame buffer before use
+		memset(*fbDest, 0xFF, fbInfo->size);
+	}
+	else
+	{
+		printf("Error creating headless frame buffer\n");
+	}
+	return success;
+}
+
+/**
+ * Open an input event device and ask the kernel to stamp its events with CLOCK_MONOTONIC.
+ * Pipes and files of InputEvent records are accepted too. Their events are stamped when read.
+ * Param path: path of the input event file. "-" means standard input.
+ * Param device: pointer to the struct that receives the opened device.
+ * return true if the device was opened.
+ */
+bool openInputDevice(const char* path, struct InputDevice* device)
+{
+	bool success;
+	int clockId = CLOCK_MONOTONIC;
+	struct stat fileStat;
+	if(!strcmp(path, "-"))
+	{
+		device->fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+		success = device->fd >= 0 && !fcntl(device->fd, F_SETFL, O_NONBLOCK);
+	}
+	else
+	{
+		// opened blocking first. a named pipe then waits for its writer 
+		// instead of reading as ended right away
+		device->fd = open(path, O_RDONLY | O_CLOEXEC);
+		success = device->fd >= 0 && !fcntl(device->fd, F_SETFL, O_NONBLOCK);
+	}
+	if(success)
+	{
+		device->isRegularFile = !fstat(device->fd, &fileStat) && S_ISREG(fileStat.st_mode);
+		device->hasMonotonicTime = !ioctl(device->fd, EVIOCSCLOCKID, &clockId);
+		if(!device->hasMonotonicTime)
+		{
+			printf("Input events are not monotonic. Using read time instead\n");
+		}
+	}
+	else
+	{
+		printf("Error opening input event device\n");
+	}
+	return success;
+}
+
+/**
+ * Open an input event file and add it to the input sources.
+ * Devices that are already open are skipped, so a scan does not duplicate explicit paths.
+ * Param path: path of the input event file. "-" means standard input.
+ * Param sources: pointer to the input sources.
+ * Param isKeysOnly: if true, skip devices that cannot report key presses.
+ * Return true unless the file could not be opened.
+ */
+bool addInputDevice(const char* path, struct InputSources* sources, bool isKeysOnly)
+{
+	bool success;
+	bool isAdded = true;
+	unsigned long eventBits = 0;
+	struct stat fileStat;
+	struct stat otherStat;
+	struct InputDevice* device = &sources->devices[sources->numDevices];
+	if(!(success = sources->numDevices < MAX_INPUT_DEVICES))
+	{
+		printf("Too many input devices\n");
+	}
+	else if((success = openInputDevice(path, device)))
+	{
+		if(isKeysOnly)
+		{
+			isAdded = ioctl(device->fd, EVIOCGBIT(0, sizeof(eventBits)), &eventBits) >= 0
+				&& (eventBits & (1ul << EV_KEY));
+		}
+		if(!fstat(device->fd, &fileStat) && S_ISCHR(fileStat.st_mode))
+		{
+			for(int i = 0; i < sources->numDevices && isAdded; ++i)
+			{
+				isAdded = fstat(sources->devices[i].fd, &otherStat) || !S_ISCHR(otherStat.st_mode) 
+					|| otherStat.st_rdev != fileStat.st_rdev;
+			}
+		}
+		if(isAdded)
+		{
+			device->isEnded = false;
+			if(device->isRegularFile)
+			{
+				sources->regularFileMask |= 1u << sources->numDevices;
+			}
+			++sources->numDevices;
+		}
+		else
+		{
+			close(device->fd);
+		}
+	}
+	return success;
+}
+
+/**
+ * Add every event device under INPUT_DIR that can report key presses.
+ * Param sources: pointer to the input sources.
+ * Return true if the directory could be read.
+ */
+bool scanInputDevices(struct InputSources* sources)
+{
+	bool success;
+	char path[sizeof(INPUT_DIR) + 256];
+	struct dirent* entry;
+	DIR* dir = opendir(INPUT_DIR);
+	if((success = dir != NULL))
+	{
+		while((entry = readdir(dir)) && sources->numDevices < MAX_INPUT_DEVICES)
+		{
+			if(!strncmp(entry->d_name, "event", 5))
+			{
+				snprintf(path, sizeof(path), "%s/%s", INPUT_DIR, entry->d_name);
+				// a device that cannot be opened is left out of the scan
+				addInputDevice(path, sources, true);
+			}
+		}
+		closedir(dir);
+	}
+	else
+	{
+		printf("Error scanning input devices\n");
+	}
+	return success;
+}
+
+/**
+ * Find the ev3 touch sensors and start the thread that polls them. 
+ * The thread feeds a pipe that is added to the input sources like an event device.
+ * Param sources: pointer to the input sources.
+ * Return true if the sensors are polled, or if there are none.
+ */
+bool setupTouchSensors(struct InputSources* sources)
+{
+	bool success = false;
+#ifdef STOPWATCH_NO_EV3
+	(void)sources;
+	printf("Touch sensors need the ev3 library\n");
+#else
+	int pipeFds[2];
+	uint8_t sn;
+	uint8_t from = 0;
+	struct InputDevice* device = &sources->devices[sources->numDevices];
+	if(ev3_sensor_init() < 0)
+	{
+		printf("Error detecting sensors\n");
+	}
+	else
+	{
+		while(sources->numSensors < MAX_TOUCH_SENSORS && ev3_search_sensor(LEGO_EV3_TOUCH, &sn, from))
+		{
+			sources->sensors[sources->numSensors++] = sn;
+			from = sn + 1;
+		}
+		if(sources->numSensors == 0)
+		{
+			printf("No touch sensors found\n");
+			success = true;
+		}
+		else if(sources->numDevices >= MAX_INPUT_DEVICES)
+		{
+			printf("Too many input devices\n");
+		}
+		else if(pipe2(pipeFds, O_NONBLOCK | O_CLOEXEC))
+		{
+			printf("Error creating touch sensor pipe\n");
+		}
+		else
+		{
+			// the thread stamps the events itself
+			device->fd = pipeFds[0];
+			device->hasMonotonicTime = true;
+			device->isRegularFile = false;
+			device->isEnded = false;
+			sources->sensorPipeFd = pipeFds[1];
+			++sources->numDevices;
+			if(!(success = startThread(&sources->sensorThread, pollTouchSensors, sources)))
+			{
+				close(sources->sensorPipeFd);
+				sources->sensorPipeFd = -1;
+				printf("Error starting touch sensor thread\n");
+			}
+		}
+	}
+#endif
+	return success;
+}
+
+/**
+ * Stop the touch sensor thread and close the write end of its pipe.
+ * Must be called before the ev3 library is released, which the thread still samples.
+ * Param sources: pointer to the input sources. Nothing happens without touch sensors.
+ */
+void stopTouchSensors(struct InputSources* sources)
+{
+	if(sources->sensorPipeFd >= 0)
+	{
+		__atomic_store_n(&sources->isSensorQuit, true, __ATOMIC_RELEASE);
+		pthread_join(sources->sensorThread, NULL);
+		close(sources->sensorPipeFd);
+		sources->sensorPipeFd = -1;
+	}
+}
+
+/**
+ * Open every input source selected on the command line.
+ * Param options: pointer to the command line options.
+ * Param sources: pointer to the struct that receives the input sources.
+ * Return true if every source was opened.
+ */
+bool openInputSources(const struct Options* options, struct InputSources* sources)
+{
+	bool success = true;
+	struct InputDevice* device;
+	memset(sources, 0, sizeof(*sources));
+	sources->sensorPipeFd = -1;
+	sources->recorder.fd = -1;
+	memcpy(sources->keyActions, options->keyActions, KEY_CNT);
+	if(options->recordPath)
+	{
+		success = openTraceRecorder(options->recordPath, &sources->recorder);
+	}
+	// a trace is played back as one more input device that the main loop feeds by itself
+	if(success && options->replayPath 
+		&& (success = openReplay(options->replayPath, options->isReplayFast, &sources->replay)))
+	{
+		device = &sources->devices[sources->numDevices++];
+		device->fd = -1;
+		device->isTrace = true;
+	}
+	for(int i = 0; i < options->numInputPaths && success; ++i)
+	{
+		success = addInputDevice(options->inputPaths[i], sources, false);
+	}
+	if(success && options->isInputScan)
+	{
+		success = scanInputDevices(sources);
+	}
+	if(success && options->isTouchSensors)
+	{
+		success = setupTouchSensors(sources);
+	}
+	if(success && !(success = sources->numDevices > 0))
+	{
+		printf("No input devices\n");
+	}
+	return success;
+}
+
+/**
+ * Create the epoll instance and redraw timer that drive the main loop.
+ * Param sources: pointer to the input sources to watch.
+ * Param eventLoop: pointer to the struct that receives the new file descriptors.
+ * return true if every descriptor was created and registered.
+ */
+bool setupEventLoop(const struct InputSources* sources, struct EventLoop* eventLoop)
+{
+	bool success;
+	struct epoll_event event;
+	eventLoop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+	eventLoop->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	eventLoop->controlFd = -1;
+	if((success = eventLoop->epollFd >= 0 && eventLoop->timerFd >= 0))
+	{
+		event.events = EPOLLIN;
+		for(int i = 0; i < sources->numDevices && success; ++i)
+		{
+			event.data.u32 = i;
+			// regular files are read on every wakeup instead. a trace is played by the main loop
+			success = sources->devices[i].isRegularFile || sources->devices[i].isTrace
+				|| !epoll_ctl(eventLoop->epollFd, EPOLL_CTL_ADD, sources->devices[i].fd, &event);
+		}
+		if(success)
+		{
+			event.data.u32 = TIMER_EVENT_ID;
+			if(!(success = !epoll_ctl(eventLoop->epollFd, EPOLL_CTL_ADD, eventLoop->timerFd, &event)))
+			{
+				printf("Error watching redraw timer\n");
+			}
+		}
+		else
+		{
+			printf("Error watching input events\n");
+		}
+	}
+	else
+	{
+		printf("Error creating event loop\n");
+	}
+	return success;
+}
+
+/**
+ * Create the control socket and let the main loop watch it.
+ * An old socket file at the same path is replaced.
+ * Param path: file path of the socket.
+ * Param eventLoop: pointer to the main loop descriptors. Receives the socket.
+ * Return true if the socket was bound and registered.
+ */
+bool setupControlSocket(const char* path, struct EventLoop* eventLoop)
+{
+	bool success;
+	struct sockaddr_un addr;
+	struct epoll_event event;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if((success = strlen(path) < sizeof(addr.sun_path)))
+	{
+		strcpy(addr.sun_path, path);
+		unlink(path);
+		eventLoop->controlFd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		event.events = EPOLLIN;
+		event.data.u32 = CONTROL_EVENT_ID;
+		if(!(success = eventLoop->controlFd >= 0 
+			&& !bind(eventLoop->controlFd, (struct sockaddr*)&addr, sizeof(addr))
+			&& !epoll_ctl(eventLoop->epollFd, EPOLL_CTL_ADD, eventLoop->controlFd, &event)))
+		{
+			printf("Error creating control socket\n");
+		}
+	}
+	else
+	{
+		printf("Control socket path too long\n");
+	}
+	return success;
+}
+
+/**
+ * Close the control socket and remove its file.
+ * Param path: file path of the socket. Nothing happens if NULL.
+ * Param eventLoop: pointer to the main loop descriptors.
+ */
+void closeControlSocket(const char* path, struct EventLoop* eventLoop)
+{
+	if(path && eventLoop->controlFd >= 0)
+	{
+		close(eventLoop->controlFd);
+		unlink(path);
+	}
+}
+
+/**
+ * Read frame buffer info using ioctl and write into a given struct.
+ * param path: path of the frame buffer device.
+ * param fbInfo: Frame buffer info is written into this struct.
+ * return: True if all info was successfully written into struct.
+ * See https://stackoverflow.com/q/75412675
+ */
+bool loadFrameValues(const char* path, struct FrameBufferInfo* fbInfo)
+{
+	bool success = true;
+	struct fb_fix_screeninfo fb_fix;
+	struct fb_var_screeninfo fb_var;
+	int fd = open(path, O_RDWR | O_CLOEXEC);
+    if ((success = fd >= 0))
+	{
+	    // Get fixed info about fb
+	    if ((success = !ioctl(fd,FBIOGET_FSCREENINFO,&fb_fix)))
+		{
+	    	// Get variable info about fb
+	    	if ((success = !ioctl(fd,FBIOGET_VSCREENINFO,&fb_var)))
+			{
+				fbInfo->size = fb_fix.smem_len;
+				fbInfo->lineLength = fb_fix.line_length;
+				fbInfo->screenWidth = fb_var.xres;
+				fbInfo->screenHeight = fb_var.yres;
+				fbInfo->bitsPP = fb_var.bits_per_pixel;
+	    	}
+			else
+			{
+	    	    printf("Error reading variable FB information\n");
+			}
+	    }
+		else
+		{
+	        printf("Error reading fixed FB information\n");
+		}
+		close(fd);
+    }
+	else
+	{
+        printf("Error opening framebuffer descriptor\n");
+	}
+	return success;
+}
+
+/**
+ * Try to give the frame buffer a second page to pan to. The virtual resolution is doubled
+ * if the driver does not already provide it. If the driver cannot pan, its screen info is put back.
+ * Param path: file path of frame buffer device.
+ * Param fbInfo: frame buffer info. The size and line length are updated when page flipping.
+ * Param display: pointer to the display. Switched to page flipping on success.
+ */
+void setupPageFlip(const char* path, struct FrameBufferInfo* fbInfo, struct FrameBufferDisplay* display)
+{
+	struct fb_fix_screeninfo fbFix;
+	struct fb_var_screeninfo fbVar;
+	struct fb_var_screeninfo origFbVar;
+	bool isResized = false;
+	bool success;
+	int fd = open(path, O_RDWR | O_CLOEXEC);
+	if((success = fd >= 0 && !ioctl(fd, FBIOGET_VSCREENINFO, &fbVar)))
+	{
+		origFbVar = fbVar;
+		if(fbVar.yres_virtual < 2 * fbVar.yres)
+		{
+			fbVar.yres_virtual = 2 * fbVar.yres;
+			// the driver may refuse or adjust the request. read back what it chose
+			isResized = !ioctl(fd, FBIOPUT_VSCREENINFO, &fbVar);
+		}
+		success = !ioctl(fd, FBIOGET_VSCREENINFO, &fbVar) 
+			&& !ioctl(fd, FBIOGET_FSCREENINFO, &fbFix)
+			&& fbVar.yres_virtual >= 2 * fbVar.yres
+			&& fbFix.ypanstep > 0
+			&& fbFix.smem_len >= 2 * fbFix.line_length * fbVar.yres;
+	}
+	if(success)
+	{
+		fbVar.yoffset = 0;
+		if((success = !ioctl(fd, FBIOPAN_DISPLAY, &fbVar)))
+		{
+			fbInfo->size = fbFix.smem_len;
+			fbInfo->lineLength = fbFix.line_length;
+			display->mode = PAGE_FLIP_DISPLAY;
+			display->fd = fd;
+			display->fbVar = fbVar;
+			display->origFbVar = origFbVar;
+			display->isResized = isResized;
+		}
+	}
+	if(!success)
+	{
+		printf("Frame buffer cannot pan. Using a shadow buffer instead\n");
+		if(isResized)
+		{
+			// the doubled geometry is of no use without panning
+			ioctl(fd, FBIOPUT_VSCREENINFO, &origFbVar);
+		}
+		if(fd >= 0)
+		{
+			close(fd);
+		}
+	}
+}
+
+/**
+ * Choose the buffer frames are composed in, once the frame buffer is mapped.
+ * Param isDoubleBuffered: if true and the display is not page flipping, use a shadow buffer.
+ * Param fbInfo: pointer to frame buffer info.
+ * Param display: pointer to the display with its frame buffer mapped.
+ * Return true if the shadow buffer could be allocated.
+ */
+bool setupDisplay(bool isDoubleBuffered, const struct FrameBufferInfo* fbInfo, struct FrameBufferDisplay* display)
+{
+	bool success = true;
+	display->pageSize = fbInfo->lineLength * fbInfo->screenHeight;
+	display->frontPage = 0;
+	display->drawDest = display->fbDest;
+	if(display->mode == PAGE_FLIP_DISPLAY)
+	{
+		// page 0 is scanned out first
+		display->drawDest = display->fbDest + display->pageSize;
+	}
+	else if(isDoubleBuffered)
+	{
+		display->mode = SHADOW_DISPLAY;
+		display->drawDest = malloc(display->pageSize);
+		if((success = display->drawDest != NULL))
+		{
+			memcpy(display->drawDest, display->fbDest, display->pageSize);
+		}
+		else
+		{
+			printf("Error allocating shadow buffer\n");
+		}
+	}
+	return success;
+}
+
+/**
+ * Release the shadow buffer and the panning descriptor of a display.
+ * A page flipping display is panned back to the first page, which gets the last frame,
+ * and the frame buffer gets back the screen info it had before.
+ * Param display: pointer to the display.
+ */
+void freeDisplay(struct FrameBufferDisplay* display)
+{
+	if(display->mode == SHADOW_DISPLAY)
+	{
+		free(display->drawDest);
+	}
+	if(display->fd >= 0)
+	{
+		if(display->frontPage != 0)
+		{
+			memcpy(display->fbDest, display->fbDest + display->pageSize, display->pageSize);
+			display->fbVar.yoffset = 0;
+			ioctl(display->fd, FBIOPAN_DISPLAY, &display->fbVar);
+		}
+		if(display->isResized)
+		{
+			ioctl(display->fd, FBIOPUT_VSCREENINFO, &display->origFbVar);
+		}
+		close(display->fd);
+	}
+}
+
+/**
+ * Touch every page of a memory region so that no page fault happens once the loop runs.
+ * Param mem: start of the region.
+ * Param size: size of the region in bytes.
+ */
+void prefaultMemory(char* mem, size_t size)
+{
+	volatile char* page = mem;
+	long pageSize = sysconf(_SC_PAGESIZE);
+	for(size_t offset = 0; offset < size; offset += pageSize)
+	{
+		// write the byte back so that copy on write pages are resolved too
+		page[offset] = page[offset];
+	}
+}
+
+/**
+ * Switch the process into real time mode. The process runs under SCHED_FIFO,
+ * every current and future page is locked into memory, and on a multi core machine 
+ * the process is pinned to the last CPU.
+ * Return true if every step succeeded.
+ */
+bool enableRealTime()
+{
+	bool success;
+	struct sched_param param;
+	cpu_set_t cpus;
+	long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = REAL_TIME_PRIORITY;
+	if((success = sched_setscheduler(0, SCHED_FIFO, &param) == 0))
+	{
+		if((success = mlockall(MCL_CURRENT | MCL_FUTURE) == 0))
+		{
+			if(numCpus > 1)
+			{
+				CPU_ZERO(&cpus);
+				CPU_SET(numCpus - 1, &cpus);
+				if(!(success = sched_setaffinity(0, sizeof(cpus), &cpus) == 0))
+				{
+					printf("Error pinning to a CPU\n");
+				}
+			}
+		}
+		else
+		{
+			printf("Error locking memory\n");
+		}
+	}
+	else
+	{
+		printf("Error enabling SCHED_FIFO. Real time mode needs root\n");
+	}
+	return success;
+}
+
+/**
+ * Dump the latency histograms whenever SIGUSR1 arrives.
+ * Return true if the handler was installed.
+ */
+bool setupLatencyDump()
+{
+	bool success;
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	// no SA_RESTART. the signal has to wake up epoll_wait
+	action.sa_handler = requestLatencyDump;
+	sigemptyset(&action.sa_mask);
+	if(!(success = sigaction(SIGUSR1, &action, NULL) == 0))
+	{
+		printf("Error installing SIGUSR1 handler\n");
+	}
+	return success;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// RENDER FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Add a request to the render queue. Called by the timing thread only.
+ * Param queue: pointer to the render queue.
+ * Param request: pointer to the request to copy in.
+ * Return false if the queue is full.
+ */
+bool pushRenderRequest(struct RenderQueue* queue, const struct RenderRequest* request)
+{
+	uint32_t tail = queue->tail;
+	bool success;
+	if((success = tail - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) < RENDER_QUEUE_SIZE))
+	{
+		queue->requests[tail & (RENDER_QUEUE_SIZE - 1)] = *request;
+		// publish the request only after it is written
+		__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+	}
+	return success;
+}
+
+/**
+ * Remove the oldest request from the render queue. Called by the render thread only.
+ * Param queue: pointer to the render queue.
+ * Param request: pointer to the struct that receives the request.
+ * Return false if the queue is empty.
+ */
+bool popRenderRequest(struct RenderQueue* queue, struct RenderRequest* request)
+{
+	uint32_t head = queue->head;
+	bool success;
+	if((success = head != __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE)))
+	{
+		*request = queue->requests[head & (RENDER_QUEUE_SIZE - 1)];
+		// hand the slot back only after it is read
+		__atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+	}
+	return success;
+}
+
+/**
+ * Fold a newer request into an older one. Newer parts replace older ones,
+ * and the oldest event timestamp is kept.
+ * Param frame: pointer to the older request. Receives the merged request.
+ * Param request: pointer to the newer request.
+ */
+void mergeRenderRequest(struct RenderRequest* frame, const struct RenderRequest* request)
+{
+	if(request->hasTitle)
+	{
+		frame->hasTitle = true;
+		frame->titleNs = request->titleNs;
+	}
+	if(request->hasSplit)
+	{
+		frame->hasSplit = true;
+		frame->splitNumber = request->splitNumber;
+		frame->lapStat = request->lapStat;
+		frame->splitNs = request->splitNs;
+	}
+	if(frame->eventNs == 0)
+	{
+		frame->eventNs = request->eventNs;
+	}
+	frame->isQuit = frame->isQuit || request->isQuit;
+}
+
+/**
+ * Request the split or lap statistic that is shown in the split history.
+ * Param history: pointer to the split history.
+ * Param request: pointer to the request that receives the split.
+ */
+void requestSplitLine(const struct SplitHistory* history, struct RenderRequest* request)
+{
+	request->hasSplit = true;
+	request->splitNumber = history->total > 0 ? history->viewIndex + 1 : 0;
+	request->splitNs = history->total > 0 ? history->splitNs[history->viewIndex % MAX_SPLITS] : 0;
+	request->lapStat = history->shownStat;
+	if(history->shownStat != LAP_STAT_NONE)
+	{
+		request->splitNs = getLapStatNs(&history->lapStats, history->shownStat);
+	}
+}
+
+/**
+ * Try to hand the pending request to the render thread. Never blocks.
+ * Param renderer: pointer to the renderer.
+ */
+void pushPendingRender(struct Renderer* renderer)
+{
+	const uint64_t ONE = 1;
+	if(renderer->isPending && pushRenderRequest(&renderer->queue, &renderer->pending))
+	{
+		renderer->isPending = false;
+		// the counter cannot realistically overflow, so this write never blocks
+		if(write(renderer->eventFd, &ONE, sizeof(ONE)) < 0)
+		{
+			printf("Error waking up the render thread\n");
+		}
+	}
+}
+
+/**
+ * Submit a request to the render thread. If the queue is full, the request is merged into
+ * the pending request, which the main loop keeps retrying.
+ * Param renderer: pointer to the renderer.
+ * Param request: pointer to the request.
+ */
+void submitRender(struct Renderer* renderer, const struct RenderRequest* request)
+{
+	if(renderer->isPending)
+	{
+		mergeRenderRequest(&renderer->pending, request);
+	}
+	else
+	{
+		renderer->pending = *request;
+		renderer->isPending = true;
+	}
+	pushPendingRender(renderer);
+}
+
+/**
+ * Draw a merged request and present it. Runs on the render thread.
+ * Param renderer: pointer to the renderer.
+ * Param frame: pointer to the merged request.
+ */
+void renderFrame(struct Renderer* renderer, const struct RenderRequest* frame)
+{
+	int64_t startNs = getMonotonicNs();
+	int64_t rasterizedNs;
+	int64_t flushedNs;
+	if(frame->hasTitle)
+	{
+		drawTitle(frame->titleNs, renderer->titleFormat, renderer->fbpm);
+	}
+	if(frame->hasSplit)
+	{
+		drawSplitLine(frame->splitNumber, frame->splitNs, frame->lapStat, 
+			renderer->splitFormat, renderer->fbpm);
+	}
+	rasterizedNs = getMonotonicNs();
+	presentFrame(renderer->display, renderer->fbpm);
+	flushedNs = getMonotonicNs();
+	recordLatency(renderer->latency, FRAME_RASTERIZE, rasterizedNs - startNs);
+	recordLatency(renderer->latency, FRAME_FLUSH, flushedNs - rasterizedNs);
+	if(frame->eventNs)
+	{
+		recordLatency(renderer->latency, BUTTON_TO_PIXEL, flushedNs - frame->eventNs);
+	}
+}
+
+/**
+ * Render thread body. Sleeps until requests arrive, then draws only the newest state.
+ * Param arg: pointer to the renderer.
+ * Return NULL.
+ */
+void* renderLoop(void* arg)
+{
+	struct Renderer* renderer = arg;
+	struct RenderRequest request;
+	struct RenderRequest frame;
+	uint64_t submitted;
+	bool hasFrame;
+	bool isQuit = false;
+	while(!isQuit)
+	{
+		// sleep until the timing thread submits something
+		if(read(renderer->eventFd, &submitted, sizeof(submitted)) > 0)
+		{
+			memset(&frame, 0, sizeof(frame));
+			hasFrame = false;
+			// stale requests are folded into the newest one
+			while(popRenderRequest(&renderer->queue, &request))
+			{
+				mergeRenderRequest(&frame, &request);
+				hasFrame = true;
+			}
+			if(hasFrame)
+			{
+				renderFrame(renderer, &frame);
+				isQuit = frame.isQuit;
+			}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Start the render thread. From now on only the render thread touches the pixel matrix.
+ * Param renderer: pointer to the renderer with its display, formats and latency set.
+ * Param isRealTime: if true, run the render thread one priority below the timing thread.
+ * Return true if the thread started.
+ */
+bool startRenderer(struct Renderer* renderer, bool isRealTime)
+{
+	bool success;
+	struct sched_param param;
+	renderer->queue.head = 0;
+	renderer->queue.tail = 0;
+	renderer->isPending = false;
+	renderer->eventFd = eventfd(0, EFD_CLOEXEC);
+	if((success = renderer->eventFd >= 0))
+	{
+		success = startThread(&renderer->thread, renderLoop, renderer);
+		if(success && isRealTime)
+		{
+			// input and clock samples preempt a frame in progress
+			memset(&param, 0, sizeof(param));
+			param.sched_priority = REAL_TIME_PRIORITY - 1;
+			pthread_setschedparam(renderer->thread, SCHED_FIFO, &param);
+		}
+		if(!success)
+		{
+			printf("Error starting the render thread\n");
+			close(renderer->eventFd);
+		}
+	}
+	else
+	{
+		printf("Error creating the render eventfd\n");
+	}
+	return success;
+}
+
+/**
+ * Let the render thread draw everything submitted so far, then wait for it to exit.
+ * Param renderer: pointer to the renderer.
+ */
+void stopRenderer(struct Renderer* renderer)
+{
+	struct RenderRequest request;
+	memset(&request, 0, sizeof(request));
+	request.isQuit = true;
+	submitRender(renderer, &request);
+	// only at exit may the timing thread wait for the render thread
+	while(renderer->isPending)
+	{
+		sched_yield();
+		pushPendingRender(renderer);
+	}
+	pthread_join(renderer->thread, NULL);
+	close(renderer->eventFd);
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// PROCESS FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Start or stop the periodic redraw timer.
+ * Deadlines are absolute, so they stay on the DRAW_NS grid of the run no matter how late
+ * a wakeup is handled.
+ * Param timerFd: redraw timer file descriptor.
+ * Param startTs: if not null, expire every DRAW_NS after this moment. Otherwise disarm.
+ * Return the first deadline in nanoseconds, or 0 if disarmed.
+ */
+int64_t armRedrawTimer(int timerFd, const struct timespec* startTs)
+{
+	struct itimerspec spec;
+	int64_t deadlineNs = 0;
+	memset(&spec, 0, sizeof(spec));
+	if(startTs)
+	{
+		deadlineNs = timespecToNs(startTs) + DRAW_NS;
+		spec.it_value.tv_sec = deadlineNs / 1000000000;
+		spec.it_value.tv_nsec = deadlineNs % 1000000000;
+		spec.it_interval.tv_sec = DRAW_NS / 1000000000;
+		spec.it_interval.tv_nsec = DRAW_NS % 1000000000;
+	}
+	timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, NULL);
+	return deadlineNs;
+}
+
+/**
+ * Record how late a redraw wakeup was and move on to the next deadline.
+ * Param stats: pointer to the wakeup statistics.
+ * Param expirations: number of deadlines the redraw timer reported.
+ */
+void recordWakeup(struct WakeupStats* stats, uint64_t expirations)
+{
+	// lateness behind the most recent deadline that passed
+	int64_t lateNs = getMonotonicNs() - (stats->deadlineNs + (int64_t)(expirations - 1) * DRAW_NS);
+	if(stats->wakeups == 0 || lateNs < stats->minLateNs)
+	{
+		stats->minLateNs = lateNs;
+	}
+	if(stats->wakeups == 0 || lateNs > stats->maxLateNs)
+	{
+		stats->maxLateNs = lateNs;
+	}
+	++stats->wakeups;
+	stats->missedDeadlines += expirations - 1;
+	stats->totalLateNs += lateNs;
+	stats->deadlineNs += expirations * DRAW_NS;
+}
+
+/**
+ * Request a redraw of a running timer at a redraw deadline. This is the only place the clock 
+ * is read while running, so a running timer costs nothing between frames.
+ * Param timer: pointer to the timer.
+ * Param isRedrawDue: true if the redraw timer has expired.
+ * Param renderer: pointer to the renderer that draws the title.
+ */
+void processTimer(struct Timer* timer, bool isRedrawDue, struct Renderer* renderer)
+{
+	struct RenderRequest request;
+	if(timer->state == RUNNING && isRedrawDue)
+	{
+		memset(&request, 0, sizeof(request));
+		request.hasTitle = true;
+		request.titleNs = getElapsedNs(timer);
+		submitRender(renderer, &request);
+	}
+}
+
+/**
+ * Hand a timer event to the telemetry stream and the journal.
+ * Param telemetry: pointer to the telemetry publisher.
+ * Param journal: pointer to the journal.
+ * Param type: the enum TelemetryType of the event.
+ * Param ts: the moment of the event.
+ * Param elapsedNs: the timer value at the event.
+ * Param splitCount: the number of splits recorded since the last reset.
+ */
+void recordTimerEvent(
+	struct Telemetry* telemetry, 
+	struct Journal* journal,
+	enum TelemetryType type, 
+	const struct timespec* ts, 
+	int64_t elapsedNs, 
+	uint32_t splitCount)
+{
+	queueTelemetry(telemetry, type, ts, elapsedNs, splitCount);
+	appendJournal(journal, type, ts, elapsedNs, splitCount);
+}
+
+/**
+ * Process a single button press.
+ * Starts, stops and splits take effect at the moment the source saw the button press.
+ * Param press: pointer to the button press.
+ * Param timer: pointer to the timer.
+ * Param splitHistory: pointer to the split history.
+ * Param request: pointer to a render request that receives the screen parts that changed.
+ * Param telemetry: pointer to the telemetry publisher that receives the timer events.
+ * Param journal: pointer to the journal that receives the timer events.
+ * Return true if the user wants to quit.
+ */
+bool processButtonPress(
+	const struct ButtonPress* press,
+	struct Timer* timer, 
+	struct SplitHistory* splitHistory, 
+	struct RenderRequest* request,
+	struct Telemetry* telemetry,
+	struct Journal* journal)
+{
+	bool isExit = false;
+	enum TelemetryType type;
+
+	switch(press->action)
+	{
+		case ACTION_QUIT:
+			isExit = true;
+			break;
+		case ACTION_START_STOP:
+			if(timer->state == PAUSED)
+			{
+				startTimer(timer, &press->time);
+				type = TELEMETRY_START;
+			}
+			else
+			{
+				stopTimer(timer, &press->time);
+				request->hasTitle = true;
+				request->titleNs = timer->accumulatedNs;
+				type = TELEMETRY_STOP;
+			}
+			recordTimerEvent(telemetry, journal, type, &press->time, timer->accumulatedNs, splitHistory->total);
+			break;
+		case ACTION_START:
+			if(timer->state == PAUSED)
+			{
+				startTimer(timer, &press->time);
+				recordTimerEvent(telemetry, journal, TELEMETRY_START, &press->time, 
+					timer->accumulatedNs, splitHistory->total);
+			}
+			break;
+		case ACTION_STOP:
+			if(timer->state == RUNNING)
+			{
+				stopTimer(timer, &press->time);
+				request->hasTitle = true;
+				request->titleNs = timer->accumulatedNs;
+				recordTimerEvent(telemetry, journal, TELEMETRY_STOP, &press->time, 
+					timer->accumulatedNs, splitHistory->total);
+			}
+			break;
+		case ACTION_PREV_SPLIT:
+			// view previous split. only the split line is redrawn
+			if(browseSplits(splitHistory, -1))
+			{
+				requestSplitLine(splitHistory, request);
+			}
+			break;
+		case ACTION_NEXT_SPLIT:
+			// view next split
+			if(browseSplits(splitHistory, 1))
+			{
+				requestSplitLine(splitHistory, request);
+			}
+			break;
+		case ACTION_RESET:
+			if(timer->state == PAUSED)
+			{
+				timer->accumulatedNs = 0;
+				timer->pausedTs = press->time;
+				clearSplits(splitHistory);
+				request->hasTitle = true;
+				request->titleNs = 0;
+				requestSplitLine(splitHistory, request);
+				recordTimerEvent(telemetry, journal, TELEMETRY_RESET, &press->time, 0, 0);
+			}
+			break;
+		case ACTION_SPLIT:
+			if(timer->state == RUNNING)
+			{
+				recordSplit(splitHistory, getElapsedNsAt(timer, &press->time));
+				requestSplitLine(splitHistory, request);
+				recordTimerEvent(telemetry, journal, TELEMETRY_SPLIT, &press->time, 
+					splitHistory->splitNs[(splitHistory->total - 1) % MAX_SPLITS], splitHistory->total);
+			}
+			break;
+		default:
+			// do nothing
+			break;
+	}
+	return isExit;
+}
+
+/**
+ * Check that a command timestamp keeps the timer in order. It must not lie in the future.
+ * While running it must not lie before the start of the run or the last split,
+ * and while stopped it must not lie before the last stop or reset.
+ * Param timer: pointer to the timer.
+ * Param splitHistory: pointer to the split history.
+ * Param ts: the moment the command takes effect.
+ * Param receivedTs: the moment the command was received.
+ * Return true if the command can take effect at that moment.
+ */
+bool isValidCommandTime(
+	const struct Timer* timer, 
+	const struct SplitHistory* splitHistory, 
+	const struct timespec* ts, 
+	const struct timespec* receivedTs)
+{
+	bool isValid = !isLater(ts, receivedTs);
+	if(isValid && timer->state == RUNNING)
+	{
+		isValid = !isLater(&timer->startTs, ts) && (splitHistory->total == 0 
+			|| getElapsedNsAt(timer, ts) >= splitHistory->splitNs[(splitHistory->total - 1) % MAX_SPLITS]);
+	}
+	else if(isValid)
+	{
+		// a run starting earlier would count the time before the stop twice
+		isValid = !isLater(&timer->pausedTs, ts);
+	}
+	return isValid;
+}
+
+/**
+ * Queue the commands of the datagrams waiting on the control socket with the button presses,
+ * so that commands and presses are applied in the order they took effect.
+ * Datagrams that do not fit in the queue wait in the socket until the next wakeup.
+ * Param controlFd: the control socket.
+ * Param sources: pointer to the input sources holding the queue and the datagrams.
+ */
+void readControlCommands(int controlFd, struct InputSources* sources)
+{
+	// the command codes in order of enum ControlCode, mapped to the matching action
+	static const uint8_t ACTIONS[] = {ACTION_NONE, ACTION_START, ACTION_STOP, ACTION_SPLIT, ACTION_RESET};
+	struct ControlCommand commands[CONTROL_MAX_COMMANDS];
+	struct ControlDatagram* datagram;
+	struct ButtonPress press;
+	ssize_t numBytes = 0;
+	while(numBytes >= 0 && sources->numDatagrams < MAX_CONTROL_DATAGRAMS
+		&& INPUT_QUEUE_SIZE - sources->queue.count >= CONTROL_MAX_COMMANDS)
+	{
+		datagram = &sources->datagrams[sources->numDatagrams];
+		datagram->senderLen = sizeof(datagram->sender);
+		numBytes = recvfrom(controlFd, commands, sizeof(commands), 0, 
+			(struct sockaddr*)&datagram->sender, &datagram->senderLen);
+		if(numBytes >= 0)
+		{
+			getTimerClock(&datagram->receivedTs);
+			datagram->numCommands = numBytes / sizeof(struct ControlCommand);
+			memset(datagram->acks, 0, datagram->numCommands * sizeof(struct ControlAck));
+			for(int i = 0; i < datagram->numCommands; ++i)
+			{
+				datagram->acks[i].code = commands[i].code;
+				if(commands[i].code >= CONTROL_START && commands[i].code <= CONTROL_RESET)
+				{
+					// until it is applied. a quit can leave it in the queue
+					datagram->acks[i].status = CONTROL_IGNORED;
+					press.action = ACTIONS[commands[i].code];
+					press.time = datagram->receivedTs;
+					if(commands[i].flags & CONTROL_FLAG_TIMESTAMP)
+					{
+						nsToTimespec(commands[i].timeNs, &press.time);
+					}
+					press.command = sources->numDatagrams * CONTROL_MAX_COMMANDS + i;
+					// room for a full datagram was checked above
+					pushButtonPress(&sources->queue, &press);
+				}
+				else
+				{
+					datagram->acks[i].status = CONTROL_UNKNOWN;
+				}
+			}
+			++sources->numDatagrams;
+		}
+	}
+}
+
+/**
+ * Apply a control command taken from the input queue and fill in its acknowledgement.
+ * Param press: pointer to the press of the command.
+ * Param datagram: pointer to the datagram of the command.
+ * Param timer: pointer to the timer.
+ * Param splitHistory: pointer to the split history.
+ * Param request: pointer to a render request that receives the screen parts that changed.
+ * Param telemetry: pointer to the telemetry publisher that receives the timer events.
+ * Param journal: pointer to the journal that receives the timer events.
+ */
+void processControlCommand(
+	const struct ButtonPress* press, 
+	struct ControlDatagram* datagram, 
+	struct Timer* timer, 
+	struct SplitHistory* splitHistory, 
+	struct RenderRequest* request, 
+	struct Telemetry* telemetry, 
+	struct Journal* journal)
+{
+	struct ControlAck* ack = &datagram->acks[press->command % CONTROL_MAX_COMMANDS];
+	enum TimerState prevState = timer->state;
+	if(!isValidCommandTime(timer, splitHistory, &press->time, &datagram->receivedTs))
+	{
+		// applying it would give a negative lap or timer value
+		ack->status = CONTROL_INVALID_TIME;
+		ack->timerNs = getElapsedNsAt(timer, &datagram->receivedTs);
+	}
+	else
+	{
+		processButtonPress(press, timer, splitHistory, request, telemetry, journal);
+		// starts and resets need a stopped timer. stops and splits need a running one
+		ack->status = (ack->code == CONTROL_START || ack->code == CONTROL_RESET)
+			== (prevState == PAUSED) ? CONTROL_APPLIED : CONTROL_IGNORED;
+		ack->timerNs = ack->code == CONTROL_SPLIT && ack->status == CONTROL_APPLIED
+			? splitHistory->splitNs[(splitHistory->total - 1) % MAX_SPLITS]
+			: getElapsedNsAt(timer, &press->time);
+	}
+	ack->splitCount = splitHistory->total;
+}
+
+/**
+ * Read input events and apply them together with the queued control commands.
+ * The presses of every ready source are merged by time first,
+ * so that presses on different sources are applied in the order they happened.
+ * Every press is handed to the render thread with its event timestamp,
+ * so that the render thread can measure its latency.
+ * Param timer: pointer to the timer.
+ * Param splitHistory: pointer to the split history.
+ * Param sources: pointer to the input sources.
+ * Param readyMask: bit i is set if device i has events to read.
+ * Param renderer: pointer to the renderer.
+ * Param shm: pointer to the shared timer state. May be NULL.
+ * Param telemetry: pointer to the telemetry publisher.
+ * Param journal: pointer to the journal.
+ * Return true if the user wants to quit.
+ */
+bool pollInput(
+	struct Timer* timer, 
+	struct SplitHistory* splitHistory, 
+	struct InputSources* sources, 
+	uint32_t readyMask, 
+	struct Renderer* renderer, 
+	struct TimerShm* shm, 
+	struct Telemetry* telemetry, 
+	struct Journal* journal)
+{
+	struct ButtonPress press;
+	struct ControlDatagram* datagram;
+	struct RenderRequest request;
+	bool isExit = false;
+	for(int i = 0; i < sources->numDevices; ++i)
+	{
+		if((readyMask & (1u << i)) && !sources->devices[i].isEnded
+			&& readInputEvents(sources, i, &sources->queue) < 0)
+		{
+			sources->devices[i].isEnded = true;
+			sources->regularFileMask &= ~(1u << i);
+			++sources->numEnded;
+		}
+	}
+	while(!isExit && popButtonPress(&sources->queue, &press))
+	{
+		memset(&request, 0, sizeof(request));
+		if(press.command >= 0)
+		{
+			// a command may take effect in the past. its latency counts from its arrival
+			datagram = &sources->datagrams[press.command / CONTROL_MAX_COMMANDS];
+			request.eventNs = virtualClockNs < 0 ? timespecToNs(&datagram->receivedTs) : 0;
+			processControlCommand(&press, datagram, timer, splitHistory, &request, telemetry, journal);
+		}
+		else
+		{
+			// a replayed press did not happen on the real clock, so it has no latency to measure
+			request.eventNs = sources->replay.mem ? 0 : timespecToNs(&press.time);
+			isExit = processButtonPress(&press, timer, splitHistory, &request, telemetry, journal);
+		}
+		submitRender(renderer, &request);
+	}
+	publishTimerState(shm, timer, splitHistory);
+	// one message per subscriber and one file write for the whole batch of presses
+	flushTelemetry(telemetry);
+	syncJournal(journal);
+	flushTrace(&sources->recorder);
+	// quit once every pipe or file of events has run dry
+	return isExit || sources->numEnded == sources->numDevices;
+}
+
+/**
+ * Answer the control datagrams whose commands have been applied.
+ * Every sender with an address gets one acknowledgement datagram for each of its datagrams.
+ * Param controlFd: the control socket.
+ * Param sources: pointer to the input sources holding the datagrams.
+ */
+void sendControlAcks(int controlFd, struct InputSources* sources)
+{
+	const struct ControlDatagram* datagram;
+	for(int i = 0; i < sources->numDatagrams; ++i)
+	{
+		datagram = &sources->datagrams[i];
+		// unbound senders cannot be answered
+		if(datagram->senderLen > sizeof(sa_family_t) && datagram->numCommands > 0)
+		{
+			sendto(controlFd, datagram->acks, datagram->numCommands * sizeof(struct ControlAck), 
+				MSG_DONTWAIT, (struct sockaddr*)&datagram->sender, datagram->senderLen);
+		}
+	}
+	sources->numDatagrams = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// BENCHMARK FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Print one benchmark result as a CSV row.
+ * Param name: name of the benchmark.
+ * Param scale: text scale. 0 if not applicable.
+ * Param bitsPP: frame buffer bits per pixel. 0 if not applicable.
+ * Param dirtyPct: percentage of dirty pixels. -1 if not applicable.
+ * Param ops: number of measured operations.
+ * Param totalNs: total measured time.
+ * Param totalBytes: total bytes written by the measured operations.
+ */
+void printBenchResult(
+	const char* name, 
+	int scale, 
+	int bitsPP, 
+	int dirtyPct, 
+	long ops, 
+	int64_t totalNs, 
+	int64_t totalBytes)
+{
+	printf("%s,%d,%d,%d,%ld,%.1f,%.1f\n", name, scale, bitsPP, dirtyPct, ops,
+		(double)totalNs / ops, (double)totalBytes / ops);
+}
+
+/**
+ * Benchmark time string formatting.
+ */
+void benchNsToString()
+{
+	const long OPS = 1000000;
+	char strBuf[BUF_SIZE];
+	int64_t totalBytes = 0;
+	int64_t startNs = getMonotonicNs();
+	for(long i = 0; i < OPS; ++i)
+	{
+		// advance by a redraw interval so that every digit position changes
+		nsToString(i * DRAW_NS, strBuf, BUF_SIZE);
+		totalBytes += strlen(strBuf) + 1;
+	}
+	printBenchResult("nsToString", 0, 0, -1, OPS, getMonotonicNs() - startNs, totalBytes);
+}
+
+/**
+ * Benchmark carrying time fields forward by a redraw interval, like the title line does.
+ * Bytes are the characters that changed.
+ */
+void benchAdvanceTimeFields()
+{
+	const long OPS = 1000000;
+	struct TimeFields fields = {0};
+	int64_t totalBytes = 0;
+	int64_t startNs = getMonotonicNs();
+	for(long i = 0; i < OPS; ++i)
+	{
+		totalBytes += __builtin_popcount(advanceTimeFields(&fields, DRAW_NS));
+	}
+	printBenchResult("advanceTimeFields", 0, 0, -1, OPS, getMonotonicNs() - startNs, totalBytes);
+}
+
+/**
+ * Benchmark rasterizing glyphs and strings into the pixel matrix at scales 1 to 4.
+ * drawString goes through a text slot registered into a blit plan, like the stopwatch does.
+ * Bytes are the pixel matrix words written: two planes for each row of pixels.
+ */
+void benchDrawString()
+{
+	const long OPS = 100000;
+	// wide enough for a 12 character string at scale 4
+	const struct FrameBufferInfo fbInfo = {256, 64, 32, 32 * 64, 1, blitSpan1};
+	// every digit differs between the two strings, so no cell can be skipped
+	char* strs[2] = {"1:00:00.000", "2:88:88.888"};
+	static struct BlitPlan blitPlan;
+	struct PixelMatrix pixelMatrix;
+	struct FrameBufferPixelMatrix fbpm;
+	struct TextFormat format;
+	int64_t startNs;
+	int64_t rowBytes;
+
+	if(allocPixelMatrix(&pixelMatrix, &fbInfo))
+	{
+		initFrameBufferPixelMatrix(&fbpm, &fbInfo, &pixelMatrix);
+		for(int scale = 1; scale <= 4 && buildBlitPlan(&blitPlan, &fbpm); ++scale)
+		{
+			rowBytes = BITMAP_HEIGHT * scale * 2 * sizeof(PixelWord);
+			initTextFormat(&format, 0, 0, scale);
+			startNs = getMonotonicNs();
+			for(long i = 0; i < OPS; ++i)
+			{
+				drawBitMap(i & 1 ? GLYPH_EIGHT : GLYPH_ZERO, &format, &fbpm);
+			}
+			printBenchResult("drawBitMap", scale, 0, -1, OPS, 
+				getMonotonicNs() - startNs, OPS * rowBytes);
+
+			registerTextSlot(&blitPlan, &format, &fbpm);
+			startNs = getMonotonicNs();
+			for(long i = 0; i < OPS; ++i)
+			{
+				drawString(strs[i & 1], &format, &fbpm);
+			}
+			printBenchResult("drawString", scale, 0, -1, OPS, 
+				getMonotonicNs() - startNs, OPS * rowBytes * strlen(strs[0]));
+			// leave a clean matrix for the next scale
+			pixelMatrix.numDirtyRects = 0;
+			freeBlitPlan(&blitPlan);
+		}
+		freePixelMatrix(&pixelMatrix);
+	}
+}
+
+/**
+ * Benchmark writing the pixel matrix into an in-memory frame buffer
+ * with the brick's screen size across bits per pixel and dirty ratios.
+ * A dirty ratio is a band of full rows at the top of the screen.
+ * Bytes are the frame buffer bytes covered by the written pixels.
+ */
+void benchWriteToFrameBuffer()
+{
+	const long OPS = 500;
+	const uint32_t BITS_PP[] = {1, 2, 4, 8, 16, 32};
+	struct FrameBufferInfo fbInfo;
+	struct PixelMatrix pixelMatrix;
+	struct FrameBufferPixelMatrix fbpm;
+	struct BlitPlan* blitPlan = malloc(sizeof(struct BlitPlan));
+	struct DirtyRect rect;
+	char* fbDest;
+	int64_t startNs;
+	int64_t totalNs;
+	int64_t totalBytes;
+
+	for(unsigned b = 0; b < sizeof(BITS_PP) / sizeof(BITS_PP[0]); ++b)
+	{
+		fbInfo.screenWidth = 178;
+		fbInfo.screenHeight = 128;
+		fbInfo.bitsPP = BITS_PP[b];
+		fbInfo.lineLength = (fbInfo.screenWidth * fbInfo.bitsPP + 7) / 8;
+		fbInfo.size = fbInfo.lineLength * fbInfo.screenHeight;
+		fbDest = malloc(fbInfo.size);
+		if(fbDest && blitPlan && selectSpanBlitter(&fbInfo) 
+			&& allocPixelMatrix(&pixelMatrix, &fbInfo))
+		{
+			initFrameBufferPixelMatrix(&fbpm, &fbInfo, &pixelMatrix);
+			buildBlitPlan(blitPlan, &fbpm);
+			for(int dirtyPct = 0; dirtyPct <= 100; dirtyPct += 25)
+			{
+				rect.top = 0;
+				rect.left = 0;
+				rect.bottom = fbInfo.screenHeight * dirtyPct / 100;
+				rect.right = fbInfo.screenWidth;
+				totalNs = 0;
+				totalBytes = 0;
+				for(long i = 0; i < OPS; ++i)
+				{
+					// flip every pixel of the band. not measured
+					for(int row = rect.top; row < rect.bottom; ++row)
+					{
+						for(int col = 0; col < rect.right; col += 16)
+						{
+							updatePixelRun(row, col, i & 1 ? 0 : 0xFFFF, 16, &fbpm);
+						}
+					}
+					if(rect.bottom > 0)
+					{
+						markDirtyRect(&pixelMatrix, rect);
+					}
+					startNs = getMonotonicNs();
+					writeToFrameBuffer(fbDest, &fbpm);
+					totalNs += getMonotonicNs() - startNs;
+					totalBytes += ((int64_t)pixelMatrix.lastFlush.pixelsWritten * fbInfo.bitsPP + 7) / 8;
+				}
+				printBenchResult("writeToFrameBuffer", 0, fbInfo.bitsPP, dirtyPct, OPS, 
+					totalNs, totalBytes);
+			}
+			freeBlitPlan(blitPlan);
+			freePixelMatrix(&pixelMatrix);
+		}
+		free(fbDest);
+	}
+	free(blitPlan);
+}
+
+/**
+ * Benchmark streaming timer events to a subscriber that keeps up and to one that never reads.
+ * Events are flushed in batches of 16, like a burst of button presses.
+ * Bytes are the message bytes the reading subscriber received per event.
+ */
+void benchTelemetry()
+{
+	const long OPS = 1000000;
+	const int BATCH = 16;
+	struct Telemetry telemetry;
+	struct TelemetryHeader header;
+	struct TelemetryRecord records[TELEMETRY_BATCH_SIZE];
+	struct timespec ts = {0, 0};
+	int fastFds[2];
+	int slowFds[2];
+	int64_t totalBytes = 0;
+	int64_t startNs;
+	int numRecords;
+	initTelemetry(&telemetry);
+	if(!socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fastFds) && !socketpair(AF_UNIX, SOCK_SEQPACKET, 0, slowFds))
+	{
+		addTelemetrySubscriber(&telemetry, fastFds[0]);
+		addTelemetrySubscriber(&telemetry, slowFds[0]);
+		startNs = getMonotonicNs();
+		for(long i = 0; i < OPS; ++i)
+		{
+			ts.tv_nsec = i % 1000000000;
+			queueTelemetry(&telemetry, TELEMETRY_SPLIT, &ts, i * DRAW_NS, i);
+			if((i + 1) % BATCH == 0)
+			{
+				flushTelemetry(&telemetry);
+				// the slow subscriber's socket fills up and it sheds records from then on
+				numRecords = readTelemetry(fastFds[1], &header, records);
+				totalBytes += sizeof(header) + numRecords * sizeof(struct TelemetryRecord);
+			}
+		}
+		printBenchResult("telemetry", 0, 0, -1, OPS, getMonotonicNs() - startNs, totalBytes);
+		for(int i = 0; i < 2; ++i)
+		{
+			close(fastFds[i]);
+			close(slowFds[i]);
+		}
+	}
+}
+
+/**
+ * Benchmark appending a session of 100k events to a journal file, then replaying it like a restart does.
+ * The session is one start followed by splits. Bytes are the journal bytes per record.
+ */
+void benchJournal()
+{
+	const long OPS = 100000;
+	char path[] = "/tmp/stopwatch-journal-XXXXXX";
+	struct Journal journal;
+	struct Timer timer;
+	// too large for the stack
+	static struct SplitHistory history;
+	struct timespec ts = {0, 0};
+	int64_t startNs;
+	int fd = mkstemp(path);
+	initJournal(&journal);
+	if(fd >= 0)
+	{
+		close(fd);
+		if(openJournal(path, &journal))
+		{
+			startNs = getMonotonicNs();
+			appendJournal(&journal, TELEMETRY_START, &ts, 0, 0);
+			for(long i = 1; i < OPS; ++i)
+			{
+				appendJournal(&journal, TELEMETRY_SPLIT, &ts, i * DRAW_NS, i);
+			}
+			printBenchResult("journalAppend", 0, 0, -1, OPS, getMonotonicNs() - startNs, 
+				OPS * sizeof(struct JournalRecord));
+			startNs = getMonotonicNs();
+			replayJournal(&journal, &timer, &history);
+			printBenchResult("journalReplay", 0, 0, -1, journal.numRecords, getMonotonicNs() - startNs, 
+				journal.numRecords * sizeof(struct JournalRecord));
+			munmap(journal.header, JOURNAL_SIZE);
+		}
+		unlink(path);
+	}
+}
+
+/**
+ * Benchmark adding millions of laps to the lap statistics, then reading every statistic.
+ * Laps are spread between 30 and 90 seconds. Bytes are 0, the statistics never grow.
+ */
+void benchLapStats()
+{
+	const long OPS = 10000000;
+	// too large for the stack
+	static struct LapStats stats;
+	uint64_t random = 1;
+	// keeps the reads from being optimized away
+	volatile int64_t statNs __attribute__((unused));
+	int64_t startNs = getMonotonicNs();
+	for(long i = 0; i < OPS; ++i)
+	{
+		// 64-bit linear congruential generator. its upper bits are used
+		random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+		updateLapStats(&stats, 30000000000LL + (int64_t)((random >> 33) % 60000000000ULL));
+	}
+	printBenchResult("updateLapStats", 0, 0, -1, OPS, getMonotonicNs() - startNs, 0);
+	startNs = getMonotonicNs();
+	for(long i = 0; i < OPS / 1000; ++i)
+	{
+		for(int stat = LAP_STAT_MIN; stat < LAP_STAT_COUNT; ++stat)
+		{
+			statNs = getLapStatNs(&stats, stat);
+		}
+	}
+	printBenchResult("getLapStatNs", 0, 0, -1, 
+		OPS / 1000 * (LAP_STAT_COUNT - 1), getMonotonicNs() - startNs, 0);
+}
+
+/**
+ * Run every benchmark and print the results as CSV.
+ */
+void runBenchmarks()
+{
+	printf("benchmark,scale,bpp,dirty_pct,ops,ns_per_op,bytes_per_op\n");
+	benchNsToString();
+	benchAdvanceTimeFields();
+	benchDrawString();
+	benchWriteToFrameBuffer();
+	benchTelemetry();
+	benchJournal();
+	benchLapStats();
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// MAIN FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Print the outcome of a replay. The splits and timer values only depend on the trace,
+ * so two replays of the same trace print the same lines and can be diffed.
+ * The playback speed goes to stderr, where it does not get in the way of a diff.
+ * Param timer: pointer to the timer.
+ * Param splitHistory: pointer to the split history.
+ * Param replay: pointer to the finished replay.
+ * Param wallNs: time the main loop took on the real clock.
+ */
+void printReplaySummary(
+	const struct Timer* timer, 
+	const struct SplitHistory* splitHistory, 
+	const struct Replay* replay, 
+	int64_t wallNs)
+{
+	uint32_t first = splitHistory->total > MAX_SPLITS ? splitHistory->total - MAX_SPLITS : 0;
+	printf("split,split_ns,lap_ns\n");
+	for(uint32_t i = first; i < splitHistory->total; ++i)
+	{
+		printf("%u,%lld,%lld\n", i + 1, 
+			(long long)splitHistory->splitNs[i % MAX_SPLITS], 
+			(long long)splitHistory->lapNs[i % MAX_SPLITS]);
+	}
+	printf("timer_ns,%lld\n", (long long)getElapsedNs(timer));
+	printf("events,%llu\n", (unsigned long long)replay->numRecords);
+	printf("redraws,%llu\n", (unsigned long long)replay->redraws);
+	fprintf(stderr, "Replayed %llu events in %lld us, %.0f events/s\n", 
+		(unsigned long long)replay->numRecords, (long long)(wallNs / 1000), wallNs > 0 ? replay->numRecords * 1e9 / wallNs : 0.0);
+}
+
+/**
+ * Main processing loop. This thread only samples the clock and reads input.
+ * All drawing happens on the render thread.
+ * Param fbInfo: pointer to frame buffer info.
+ * Param display: pointer to the display frames are presented on.
+ * Param sources: pointer to the input sources.
+ * Param eventLoop: pointer to the descriptors that wake up the loop.
+ * Param timer: pointer to the timer. May hold a session restored from the journal.
+ * Param splitHistory: pointer to the split history. May hold restored splits.
+ * Param telemetry: pointer to the telemetry publisher.
+ * Param journal: pointer to the journal.
+ * Param isRealTime: if true, prefault the buffers and measure the wakeup jitter.
+ * Param isLatencyReport: if true, print the latency histograms on exit.
+ */
+void performMainLoop(
+	struct FrameBufferInfo* fbInfo, 
+	struct FrameBufferDisplay* display, 
+	struct InputSources* sources, 
+	const struct EventLoop* eventLoop,
+	struct Timer* timer,
+	struct SplitHistory* splitHistory,
+	struct Telemetry* telemetry,
+	struct Journal* journal,
+	bool isRealTime,
+	bool isLatencyReport)
+{
+	struct epoll_event events[MAX_LOOP_EVENTS];
+	int numEvents;
+	uint64_t expirations;
+	bool isRedrawDue;
+	uint32_t readyMask;
+	bool isControlReady;
+	enum TimerState prevState;
+	struct PixelMatrix pixelMatrix;
+	struct TextFormat titleFormat, splitFormat;
+	struct RenderRequest splitLine;
+	// too large for the stack
+	static struct BlitPlan blitPlan;
+	struct FrameBufferPixelMatrix fbpm;
+	// too large for the stack
+	static struct Renderer renderer;
+	struct TimerShm* shm;
+	struct WakeupStats wakeupStats;
+	// too large for the stack
+	static struct LatencyStats latency;
+	int64_t nowNs;
+	int64_t intervalErrorNs;
+	int timeoutMs;
+	bool isTraceDue;
+	bool isExit = false;
+	struct Replay* replay = &sources->replay;
+
+	// pre-loop inits
+	if(!allocPixelMatrix(&pixelMatrix, fbInfo))
+	{
+		return;
+	}
+	// frame buffer info is copied into fbpm struct
+	initFrameBufferPixelMatrix(&fbpm, fbInfo, &pixelMatrix);
+	initTextFormat(&titleFormat, 16, 16, 3);
+	initTextFormat(&splitFormat, 48, 16, 2);
+	// the layout never changes, so compile it once
+	if(!buildBlitPlan(&blitPlan, &fbpm) 
+		|| !registerTextSlot(&blitPlan, &titleFormat, &fbpm)
+		|| !registerTextSlot(&blitPlan, &splitFormat, &fbpm))
+	{
+		freeBlitPlan(&blitPlan);
+		freePixelMatrix(&pixelMatrix);
+		return;
+	}
+	memset(&wakeupStats, 0, sizeof(wakeupStats));
+	if(isRealTime)
+	{
+		// locked memory is not necessarily populated. fault it in before the first deadline
+		prefaultMemory((char*)pixelMatrix.fgPlane, 
+			(size_t)pixelMatrix.wordsPerRow * fbInfo->screenHeight * 2 * sizeof(PixelWord));
+		prefaultMemory((char*)blitPlan.rowOffsets, fbInfo->screenHeight * sizeof(uint32_t));
+	}
+	// other processes read the timer state from here. the stopwatch runs without it.
+	// a replayed timer runs on the virtual clock, so it must not replace the state of a live one
+	shm = sources->replay.mem ? NULL : setupTimerShm();
+	publishTimerState(shm, timer, splitHistory);
+	drawTitle(getElapsedNs(timer), &titleFormat, &fbpm);
+	memset(&splitLine, 0, sizeof(splitLine));
+	requestSplitLine(splitHistory, &splitLine);
+	drawSplitLine(splitLine.splitNumber, splitLine.splitNs, splitLine.lapStat, &splitFormat, &fbpm);
+	presentFrame(display, &fbpm);
+	// the render thread owns the pixel matrix from now on
+	renderer.display = display;
+	renderer.fbpm = &fbpm;
+	renderer.titleFormat = &titleFormat;
+	renderer.splitFormat = &splitFormat;
+	renderer.latency = &latency;
+	if(!startRenderer(&renderer, isRealTime))
+	{
+		closeTimerShm(shm);
+		freeBlitPlan(&blitPlan);
+		freePixelMatrix(&pixelMatrix);
+		return;
+	}
+	if(timer->state == RUNNING)
+	{
+		// a session restored from the journal keeps running
+		wakeupStats.deadlineNs = armRedrawTimer(eventLoop->timerFd, &timer->startTs);
+	}
+	nowNs = getMonotonicNs();
+
+	do
+	{
+		// sleep until a button event or a redraw deadline. 
+		// the redraw timer is disarmed while paused, so only a button can wake us up.
+		// a request stuck behind a full render queue is retried every millisecond
+		timeoutMs = sources->regularFileMask ? 0 : renderer.isPending ? 1 : -1;
+		if(replay->mem && (timeoutMs < 0 || getReplayTimeoutMs(replay) < timeoutMs))
+		{
+			// the replay keeps the redraw deadlines of the virtual clock itself
+			timeoutMs = getReplayTimeoutMs(replay);
+		}
+		numEvents = epoll_wait(eventLoop->epollFd, events, MAX_LOOP_EVENTS, timeoutMs);
+		pushPendingRender(&renderer);
+		isRedrawDue = false;
+		isControlReady = false;
+		readyMask = sources->regularFileMask;
+		// SIGUSR1 interrupts epoll_wait, so the dump happens right away.
+		// the render thread keeps recording meanwhile, so the counts are only a snapshot
+		if(isLatencyDumpRequested)
+		{
+			isLatencyDumpRequested = 0;
+			printLatencyStats(&latency);
+		}
+		for(int i = 0; i < numEvents; ++i)
+		{
+			if(events[i].data.u32 == TIMER_EVENT_ID)
+			{
+				// acknowledge the expiration. missed deadlines are merged into one redraw
+				isRedrawDue = read(eventLoop->timerFd, &expirations, sizeof(expirations)) > 0;
+				if(isRedrawDue && isRealTime)
+				{
+					recordWakeup(&wakeupStats, expirations);
+				}
+				if(isRedrawDue)
+				{
+					nowNs = getMonotonicNs();
+					if(latency.lastRedrawNs)
+					{
+						intervalErrorNs = nowNs - latency.lastRedrawNs - (int64_t)expirations * DRAW_NS;
+						recordLatency(&latency, REDRAW_INTERVAL_ERROR, 
+							intervalErrorNs < 0 ? -intervalErrorNs : intervalErrorNs);
+					}
+					latency.lastRedrawNs = nowNs;
+				}
+			}
+			else if(events[i].data.u32 == CONTROL_EVENT_ID)
+			{
+				isControlReady = true;
+			}
+			else if(events[i].data.u32 == TELEMETRY_EVENT_ID)
+			{
+				acceptTelemetrySubscribers(telemetry);
+			}
+			else
+			{
+				readyMask |= 1u << events[i].data.u32;
+			}
+		}
+		if(replay->mem && !getReplayTimeoutMs(replay))
+		{
+			// the trace device is at index 0 and only becomes ready on the virtual clock
+			isRedrawDue = advanceReplay(replay, &isTraceDue);
+			readyMask |= isTraceDue ? 1u : 0;
+		}
+		processTimer(timer, isRedrawDue, &renderer);
+		prevState = timer->state;
+		if(isControlReady)
+		{
+			// control commands are applied in time order with the button presses
+			readControlCommands(eventLoop->controlFd, sources);
+		}
+		if(readyMask || isControlReady)
+		{
+			isExit = pollInput(timer, splitHistory, sources, readyMask, &renderer, shm, telemetry, journal);
+		}
+		if(isControlReady)
+		{
+			sendControlAcks(eventLoop->controlFd, sources);
+		}
+		if(timer->state != prevState && replay->mem)
+		{
+			replay->redrawNs = timer->state == RUNNING ? timespecToNs(&timer->startTs) + DRAW_NS : 0;
+		}
+		else if(timer->state != prevState)
+		{
+			wakeupStats.deadlineNs = armRedrawTimer(eventLoop->timerFd, 
+				timer->state == RUNNING ? &timer->startTs : NULL);
+			latency.lastRedrawNs = 0;
+		}
+	} while(!isExit);
+
+	stopRenderer(&renderer);
+	closeTimerShm(shm);
+	if(replay->mem)
+	{
+		printReplaySummary(timer, splitHistory, replay, getMonotonicNs() - nowNs);
+	}
+	if(isRealTime)
+	{
+		printWakeupStats(&wakeupStats);
+	}
+	if(isLatencyReport)
+	{
+		printLatencyStats(&latency);
+		// the render thread has stopped, so the pixel matrix can be read here
+		printFlushStats(&pixelMatrix);
+	}
+	freeBlitPlan(&blitPlan);
+	freePixelMatrix(&pixelMatrix);
+}
+
+/**
+ * Print command line usage.
+ * Param program: name of the executable.
+ */
+void printUsage(const char* program)
+{
+	printf("Usage: %s [options]\n", program);
+	printf("  --headless WxHxBPP  draw into a memory frame buffer of the given geometry\n");
+	printf("  --fb PATH           frame buffer device (default %s).\n", DEFAULT_FB_PATH);
+	printf("                      with --headless, a file that backs the frame buffer\n");
+	printf("  --input PATH        input event device, pipe or file of input events.\n");
+	printf("                      - reads standard input. may be given up to %d times\n", MAX_INPUT_DEVICES);
+	printf("                      (default %s)\n", DEFAULT_INPUT_PATH);
+	printf("  --input-scan        also read every key device under %s\n", INPUT_DIR);
+	printf("  --touch-sensors     touch sensors start and stop, or split after the first\n");
+	printf("  --map CODE=ACTION   map a key code to quit, start-stop, start, stop, split,\n");
+	printf("                      reset, prev, next or none\n");
+	printf("  --bench             run the microbenchmarks and print CSV\n");
+	printf("  --realtime          run under SCHED_FIFO with locked memory and print\n");
+	printf("                      the redraw wakeup jitter on exit. needs root\n");
+	printf("  --latency           print the latency histograms as CSV on exit.\n");
+	printf("                      SIGUSR1 prints them at any time\n");
+	printf("  --double-buffer     compose frames off-screen and pan to them, or copy\n");
+	printf("                      their changed bytes when the display cannot pan\n");
+	printf("  --control PATH      accept batched commands on a UNIX datagram socket\n");
+	printf("  --telemetry PATH    stream timer events to subscribers of a UNIX seqpacket socket\n");
+	printf("  --journal PATH      keep the session in a journal file and resume it on start\n");
+	printf("  --record PATH       record every input event read into a trace file\n");
+	printf("  --replay PATH       play a trace back on a virtual clock instead of the\n");
+	printf("                      default input, then print the splits and final time\n");
+	printf("  --fast              with --replay, play back as fast as possible\n");
+}
+
+/**
+ * Parse the command line.
+ * Param argc: number of arguments.
+ * Param argv: the arguments.
+ * Param options: pointer to the struct that receives the options.
+ * Return true if every argument was understood.
+ */
+bool parseOptions(int argc, char** argv, struct Options* options)
+{
+	static const struct option LONG_OPTIONS[] = {
+		{"headless", required_argument, NULL, 'h'},
+		{"fb", required_argument, NULL, 'f'},
+		{"input", required_argument, NULL, 'i'},
+		{"bench", no_argument, NULL, 'b'},
+		{"realtime", no_argument, NULL, 'r'},
+		{"latency", no_argument, NULL, 'l'},
+		{"double-buffer", no_argument, NULL, 'd'},
+		{"control", required_argument, NULL, 'c'},
+		{"input-scan", no_argument, NULL, 's'},
+		{"touch-sensors", no_argument, NULL, 't'},
+		{"map", required_argument, NULL, 'm'},
+		{"telemetry", required_argument, NULL, 'e'},
+		{"journal", required_argument, NULL, 'j'},
+		{"record", required_argument, NULL, 'o'},
+		{"replay", required_argument, NULL, 'p'},
+		{"fast", no_argument, NULL, 'a'},
+		{NULL, 0, NULL, 0}};
+	bool success = true;
+	int opt;
+
+	memset(options, 0, sizeof(*options));
+	initKeyActions(options->keyActions);
+	while(success && (opt = getopt_long(argc, argv, "", LONG_OPTIONS, NULL)) != -1)
+	{
+		switch(opt)
+		{
+			case 'h':
+				options->isHeadless = true;
+				success = sscanf(optarg, "%ux%ux%u", &options->headlessWidth, 
+					&options->headlessHeight, &options->headlessBitsPP) == 3
+					&& options->headlessWidth > 0 && options->headlessHeight > 0
+					&& options->headlessBitsPP > 0 && options->headlessBitsPP <= 32;
+				break;
+			case 'f':
+				options->fbPath = optarg;
+				break;
+			case 'i':
+				if((success = options->numInputPaths < MAX_INPUT_DEVICES))
+				{
+					options->inputPaths[options->numInputPaths++] = optarg;
+				}
+				break;
+			case 'b':
+				options->isBench = true;
+				break;
+			case 'r':
+				options->isRealTime = true;
+				break;
+			case 'l':
+				options->isLatencyReport = true;
+				break;
+			case 'd':
+				options->isDoubleBuffered = true;
+				break;
+			case 'c':
+				options->controlPath = optarg;
+				break;
+			case 's':
+				options->isInputScan = true;
+				break;
+			case 't':
+				options->isTouchSensors = true;
+				break;
+			case 'm':
+				success = parseKeyMapping(optarg, options->keyActions);
+				break;
+			case 'e':
+				options->telemetryPath = optarg;
+				break;
+			case 'j':
+				options->journalPath = optarg;
+				break;
+			case 'o':
+				options->recordPath = optarg;
+				break;
+			case 'p':
+				options->replayPath = optarg;
+				break;
+			case 'a':
+				options->isReplayFast = true;
+				break;
+			default:
+				success = false;
+				break;
+		}
+	}
+	// a replay starts from an empty session on its own clock, so it cannot resume a journal
+	if((success = success && optind == argc && !(options->replayPath && options->journalPath)
+		&& (options->replayPath || !options->isReplayFast)))
+	{
+		if(!options->isHeadless && !options->fbPath)
+		{
+			options->fbPath = DEFAULT_FB_PATH;
+		}
+		// a scan, the sensors or a replay replace the brick buttons unless they are asked for
+		if(options->numInputPaths == 0 && !options->isInputScan && !options->isTouchSensors 
+			&& !options->replayPath)
+		{
+			options->inputPaths[options->numInputPaths++] = DEFAULT_INPUT_PATH;
 		}
-		ev3_uninit();
 	}
 	else
 	{
-		printf("EV3 failed to init\n");
+		printUsage(argv[0]);
+	}
+	return success;
+}
+
+/**
+ * Perform initializations on the given pointers.
+ * Param options: pointer to the command line options.
+ * Param fbInfo: pointer to frame buffer info struct.
+ * Param display: pointer to the display that receives the memory mapped frame buffer.
+ * Param sources: pointer to the struct that receives the input sources.
+ * Param eventLoop: pointer to the main loop file descriptors.
+ * Param telemetry: pointer to the telemetry publisher.
+ * Param timer: pointer to the timer. Receives the session restored from the journal.
+ * Param splitHistory: pointer to the split history. Receives the restored splits.
+ * Param journal: pointer to the journal.
+ * Return true if initialization was a success.
+ */
+bool initMain(
+	const struct Options* options,
+	struct FrameBufferInfo* fbInfo, 
+	struct FrameBufferDisplay* display, 
+	struct InputSources* sources, 
+	struct EventLoop* eventLoop,
+	struct Telemetry* telemetry,
+	struct Timer* timer,
+	struct SplitHistory* splitHistory,
+	struct Journal* journal)
+{
+	bool success;
+	display->mode = DIRECT_DISPLAY;
+	display->fd = -1;
+	initTelemetry(telemetry);
+	initJournal(journal);
+	// no touch sensor thread to stop until the input sources are opened
+	sources->sensorPipeFd = -1;
+	memset(timer, 0, sizeof(*timer));
+	timer->state = PAUSED;
+	clearSplits(splitHistory);
+	// enable graphics mode. a headless frame buffer does not need it
+	if((success = options->isHeadless || enableGraphicsMode()))
+	{
+		// obtain the input event devices and touch sensors
+		if((success = openInputSources(options, sources)))
+		{
+			if(options->isHeadless)
+			{
+				success = setupHeadlessFrameBuffer(options, fbInfo, &display->fbDest) 
+					&& selectSpanBlitter(fbInfo);
+			}
+			// load frame buffer values into struct
+			else if((success = loadFrameValues(options->fbPath, fbInfo)))
+			{
+				if(options->isDoubleBuffered)
+				{
+					// before the memory map. a second page can grow the frame buffer
+					setupPageFlip(options->fbPath, fbInfo, display);
+				}
+				// choose the pixel writer once for the whole run, then setup memory map
+				success = selectSpanBlitter(fbInfo) 
+					&& setupMmap(options->fbPath, fbInfo, &display->fbDest);
+			}
+			if(success)
+			{
+				success = setupDisplay(options->isDoubleBuffered, fbInfo, display);
+			}
+			if(success)
+			{
+				// watch for input events, control commands, subscribers and redraw deadlines
+				success = setupEventLoop(sources, eventLoop) && setupLatencyDump()
+					&& (!options->controlPath || setupControlSocket(options->controlPath, eventLoop))
+					&& (!options->telemetryPath || setupTelemetry(options->telemetryPath, eventLoop, telemetry));
+			}
+			if(success && options->journalPath)
+			{
+				// before the real time mode, so that the sync thread keeps the default scheduling
+				if((success = openJournal(options->journalPath, journal)))
+				{
+					replayJournal(journal, timer, splitHistory);
+					success = startJournalSync(journal);
+				}
+			}
+			if(success && options->isRealTime)
+			{
+				// after the memory map so that the frame buffer is locked as well
+				if((success = enableRealTime()))
+				{
+					prefaultMemory(display->fbDest, fbInfo->size);
+				}
+			}
+		}
+	}
+	return success;
+}
+
+int main(int argc, char** argv)
+{
+	bool success;
+	struct Options options;
+	struct FrameBufferInfo fbInfo;
+	struct InputSources sources;
+	struct FrameBufferDisplay display;
+	struct EventLoop eventLoop;
+	struct Telemetry telemetry;
+	struct Timer timer;
+	// too large for the stack
+	static struct SplitHistory splitHistory;
+	struct Journal journal;
+
+	if((success = parseOptions(argc, argv, &options)) && options.isBench)
+	{
+		runBenchmarks();
+	}
+	else if(success)
+	{
+		// the ev3 library is only needed on the brick
+		if((success = options.isHeadless || ev3_init() >= 1))
+		{
+			if((success = initMain(&options, &fbInfo, &display, &sources, &eventLoop, 
+				&telemetry, &timer, &splitHistory, &journal)))
+			{
+				performMainLoop(&fbInfo, &display, &sources, &eventLoop, &timer, &splitHistory, 
+					&telemetry, &journal, options.isRealTime, options.isLatencyReport);
+				closeControlSocket(options.controlPath, &eventLoop);
+				closeTelemetry(options.telemetryPath, &telemetry);
+				closeJournal(&journal);
+				closeTraceRecorder(&sources.recorder);
+				closeReplay(&sources.replay);
+				freeDisplay(&display);
+			}
+			else
+			{
+				printf("Main init failed\n");
+			}
+			// the sensor thread samples through the ev3 library until it is joined
+			stopTouchSensors(&sources);
+			if(!options.isHeadless)
+			{
+				ev3_uninit();
+			}
+		}
+		else
+		{
+			printf("EV3 failed to init\n");
+		}
 	}
 	return success ? 0 : 1;
 }
@@ -0,0 +1,102 @@
+// uint8_t, uint32_t, int64_t
+#include <stdint.h>
+// strlen, strcpy
+#include <string.h>
+// readv
+#include <sys/uio.h>
+// socket, connect
+#include <sys/socket.h>
+#include <sys/un.h>
+// close
+#include <unistd.h>
+
+// most records sent in one message. a subscriber buffer of this many records never truncates
+#define TELEMETRY_BATCH_SIZE 64
+
+/**
+ * Timer events streamed to telemetry subscribers.
+ */
+enum TelemetryType
+{
+	TELEMETRY_START = 1,
+	TELEMETRY_STOP,
+	TELEMETRY_SPLIT,
+	TELEMETRY_RESET
+};
+
+/**
+ * Start of every telemetry message. The records of the message follow it.
+ */
+struct TelemetryHeader
+{
+	uint32_t numRecords;
+	uint32_t reserved;
+	// number of the first record of the message among every record the stopwatch sent.
+	// a gap to the previous message means the subscriber fell behind and records were shed
+	uint64_t firstIndex;
+};
+
+/**
+ * One timer event.
+ */
+struct TelemetryRecord
+{
+	// enum TelemetryType
+	uint8_t type;
+	uint8_t reserved[3];
+	// number of splits recorded since the last reset. for a split, the number of that split
+	uint32_t splitCount;
+	// CLOCK_MONOTONIC moment of the event
+	int64_t timeNs;
+	// timer value at the event
+	int64_t elapsedNs;
+};
+
+/**
+ * Subscribe to the telemetry stream of a stopwatch.
+ * Param path: file path of the telemetry socket.
+ * Return the connected socket, or -1 on failure.
+ */
+static inline int openTelemetry(const char* path)
+{
+	struct sockaddr_un addr;
+	int fd = -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) < sizeof(addr.sun_path))
+	{
+		strcpy(addr.sun_path, path);
+		fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+		if(fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)))
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+	return fd;
+}
+
+/**
+ * Receive one telemetry message. Blocks unless the socket is non blocking.
+ * Param fd: the subscribed socket.
+ * Param header: pointer to the struct that receives the message header.
+ * Param records: array of TELEMETRY_BATCH_SIZE records that receives the records.
+ * Return the number of records received. 0 if the stopwatch has quit, -1 on error.
+ */
+static inline int readTelemetry(int fd, struct TelemetryHeader* header, struct TelemetryRecord* records)
+{
+	struct iovec iov[2] = {
+		{header, sizeof(*header)},
+		{records, TELEMETRY_BATCH_SIZE * sizeof(struct TelemetryRecord)}};
+	ssize_t numBytes = readv(fd, iov, 2);
+	int numRecords = -1;
+	if(numBytes == 0)
+	{
+		numRecords = 0;
+	}
+	else if(numBytes >= (ssize_t)sizeof(*header))
+	{
+		numRecords = (numBytes - sizeof(*header)) / sizeof(struct TelemetryRecord);
+	}
+	return numRecords;
+}
@@ -0,0 +1,116 @@
+// uint32_t, int64_t
+#include <stdint.h>
+// bool
+#include <stdbool.h>
+// memcpy
+#include <string.h>
+// clock_gettime
+#include <time.h>
+// shm_open
+#include <fcntl.h>
+#include <sys/mman.h>
+// close
+#include <unistd.h>
+
+// POSIX shared memory object the stopwatch publishes its timer state in
+#define TIMER_SHM_NAME "/ev3-simple-stopwatch"
+// layout version. bumped whenever struct TimerShm changes
+#define TIMER_SHM_VERSION 1
+// number of most recent splits that are published
+#define TIMER_SHM_SPLITS 16
+
+/**
+ * Timer state shared with other processes. Written by the stopwatch only.
+ * Guarded by a seqlock: sequence is odd while the stopwatch is updating the state.
+ * Timestamps are CLOCK_MONOTONIC nanoseconds.
+ */
+struct TimerShm
+{
+	uint32_t version;
+	uint32_t sequence;
+	uint32_t isRunning;
+	// number of splits recorded since the last reset. may exceed TIMER_SHM_SPLITS
+	uint32_t splitCount;
+	// the moment the current run started. only meaningful while running
+	int64_t startNs;
+	// time counted before the current run
+	int64_t accumulatedNs;
+	// split number n is stored at index (n - 1) % TIMER_SHM_SPLITS
+	int64_t splitNs[TIMER_SHM_SPLITS];
+};
+
+/**
+ * Map the published timer state read only.
+ * Return a pointer to the state, or NULL if the stopwatch is not running
+ * or publishes a different layout.
+ */
+static inline const struct TimerShm* openTimerShm()
+{
+	const struct TimerShm* shm = NULL;
+	void* mem;
+	int fd = shm_open(TIMER_SHM_NAME, O_RDONLY, 0);
+	if(fd >= 0)
+	{
+		mem = mmap(0, sizeof(struct TimerShm), PROT_READ, MAP_SHARED, fd, 0);
+		if(mem != MAP_FAILED)
+		{
+			shm = mem;
+			if(shm->version != TIMER_SHM_VERSION)
+			{
+				munmap(mem, sizeof(struct TimerShm));
+				shm = NULL;
+			}
+		}
+		close(fd);
+	}
+	return shm;
+}
+
+/**
+ * Copy a consistent snapshot of the published timer state. Retries while the stopwatch
+ * is updating it, and never makes the stopwatch wait.
+ * Param shm: pointer to the mapped timer state.
+ * Param snapshot: pointer to the struct that receives the copy.
+ */
+static inline void readTimerShm(const struct TimerShm* shm, struct TimerShm* snapshot)
+{
+	uint32_t before;
+	uint32_t after;
+	do
+	{
+		before = __atomic_load_n(&shm->sequence, __ATOMIC_ACQUIRE);
+		memcpy(snapshot, shm, sizeof(*snapshot));
+		// the copy must complete before the sequence is read again
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&shm->sequence, __ATOMIC_RELAXED);
+	} while((before & 1) || before != after);
+}
+
+/**
+ * Calculate the live timer value from a snapshot with a single clock read.
+ * Param snapshot: pointer to a snapshot taken by readTimerShm.
+ * Return the timer value in nanoseconds.
+ */
+static inline int64_t getTimerShmElapsedNs(const struct TimerShm* snapshot)
+{
+	struct timespec ts;
+	int64_t elapsedNs = snapshot->accumulatedNs;
+	if(snapshot->isRunning)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		elapsedNs += (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec - snapshot->startNs;
+	}
+	return elapsedNs;
+}
+
+/**
+ * Read the live timer value.
+ * Param shm: pointer to the mapped timer state.
+ * Return the timer value in nanoseconds.
+ */
+static inline int64_t readTimerShmElapsedNs(const struct TimerShm* shm)
+{
+	struct TimerShm snapshot;
+	readTimerShm(shm, &snapshot);
+	return getTimerShmElapsedNs(&snapshot);
+}